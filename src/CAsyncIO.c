@@ -0,0 +1,447 @@
+/**
+ * @file CAsyncIO.c
+ * @brief Asynchronous file I/O for batch conversion Implementation
+ * @author Oneonestar <oneonestar@gmail.com>
+ * @version 1.0
+ * @date 2012-10-27
+ * @copyright 2012 Oneonestar
+ *
+ * @section LICENSE
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#define _GNU_SOURCE
+#include "CAsyncIO.h"
+#ifndef _WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#endif
+#ifdef __linux__
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#endif
+
+/*stages of a slot, also the low bits of the io_uring user_data*/
+#define STAGE_OPEN_IN 0
+#define STAGE_READ 1
+#define STAGE_OPEN_OUT 2
+#define STAGE_WRITE 3
+#define STAGE_CLOSE 4
+
+/**
+ * @brief Allocate the buffers of n slots
+ * @retval -1 out of memory, nothing is kept
+ */
+static int allocSlots(AsyncIO *io, int n)
+{
+	int i;
+	for(i=0; i<n; i++)
+	{
+		io->slot[i].file = -1;
+		io->slot[i].fd = -1;
+		io->slot[i].input = malloc(ASYNC_BUFFER_SIZE);
+		io->slot[i].output = malloc(ASYNC_BUFFER_SIZE);
+		io->slots = i+1;
+		if(io->slot[i].input==NULL || io->slot[i].output==NULL)
+		{
+			closeAsyncIO(io);
+			return -1;
+		}
+	}
+	return 0;
+}
+
+#ifdef __linux__
+/**
+ * @brief Check that the kernel has every operation of the pipeline
+ * @details io_uring_setup works from 5.1, open, close and plain read/write only from 5.6,
+ * older kernels fail every file with -EINVAL. They have no probe either.
+ * @retval -1 an operation is missing
+ */
+static int probeRing(int ringFd)
+{
+	static const unsigned char needed[] = {IORING_OP_OPENAT, IORING_OP_CLOSE, IORING_OP_READ,
+		IORING_OP_WRITE, IORING_OP_READ_FIXED, IORING_OP_WRITE_FIXED};
+	struct io_uring_probe *probe;
+	size_t i;
+	int ok;
+
+	probe = calloc(1, sizeof(struct io_uring_probe) + 256*sizeof(struct io_uring_probe_op));
+	if(probe == NULL)
+		return -1;
+	ok = !syscall(__NR_io_uring_register, ringFd, IORING_REGISTER_PROBE, probe, 256);
+	for(i=0; ok && i<sizeof(needed); i++)
+		ok = needed[i] < probe->ops_len && probe->ops[needed[i]].flags & IO_URING_OP_SUPPORTED;
+	free(probe);
+	return ok? 0: -1;
+}
+
+/**
+ * @brief Map the rings of a new io_uring and register the slot buffers
+ * @retval -1 the kernel refuses io_uring or lacks an operation, the caller falls back to pread
+ */
+static int setupRing(AsyncIO *io)
+{
+	struct io_uring_params params;
+	struct iovec iov[2*ASYNC_QUEUE_DEPTH];
+	unsigned char *sq, *cq;
+	int i;
+
+	memset(&params, 0, sizeof(params));
+	/*one operation per slot plus the closes still in flight*/
+	io->ringFd = syscall(__NR_io_uring_setup, 4*ASYNC_QUEUE_DEPTH, &params);
+	if(io->ringFd < 0 || probeRing(io->ringFd))
+		return -1;
+	io->sqRingSize = params.sq_off.array + params.sq_entries*sizeof(unsigned);
+	io->cqRingSize = params.cq_off.cqes + params.cq_entries*sizeof(struct io_uring_cqe);
+	if(params.features & IORING_FEAT_SINGLE_MMAP && io->cqRingSize > io->sqRingSize)
+		io->sqRingSize = io->cqRingSize;
+	io->sqesSize = params.sq_entries*sizeof(struct io_uring_sqe);
+	io->sqRing = mmap(NULL, io->sqRingSize, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_POPULATE, io->ringFd, IORING_OFF_SQ_RING);
+	if(io->sqRing == MAP_FAILED)
+	{
+		io->sqRing = NULL;
+		return -1;
+	}
+	if(params.features & IORING_FEAT_SINGLE_MMAP)
+		io->cqRing = io->sqRing;
+	else
+	{
+		io->cqRing = mmap(NULL, io->cqRingSize, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_POPULATE, io->ringFd, IORING_OFF_CQ_RING);
+		if(io->cqRing == MAP_FAILED)
+		{
+			io->cqRing = NULL;
+			return -1;
+		}
+	}
+	io->sqes = mmap(NULL, io->sqesSize, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_POPULATE, io->ringFd, IORING_OFF_SQES);
+	if(io->sqes == MAP_FAILED)
+	{
+		io->sqes = NULL;
+		return -1;
+	}
+	sq = io->sqRing;
+	cq = io->cqRing;
+	io->sqHead = (unsigned*)(sq+params.sq_off.head);
+	io->sqTail = (unsigned*)(sq+params.sq_off.tail);
+	io->sqMask = (unsigned*)(sq+params.sq_off.ring_mask);
+	io->sqArray = (unsigned*)(sq+params.sq_off.array);
+	io->cqHead = (unsigned*)(cq+params.cq_off.head);
+	io->cqTail = (unsigned*)(cq+params.cq_off.tail);
+	io->cqMask = (unsigned*)(cq+params.cq_off.ring_mask);
+	io->cqes = cq+params.cq_off.cqes;
+
+	/*input buffers are 0..slots-1, output buffers follow, unregistered buffers still work*/
+	for(i=0; i<io->slots; i++)
+	{
+		iov[i].iov_base = io->slot[i].input;
+		iov[i].iov_len = ASYNC_BUFFER_SIZE;
+		iov[io->slots+i].iov_base = io->slot[i].output;
+		iov[io->slots+i].iov_len = ASYNC_BUFFER_SIZE;
+	}
+	io->registered = !syscall(__NR_io_uring_register, io->ringFd, IORING_REGISTER_BUFFERS, iov, 2*io->slots);
+	return 0;
+}
+
+/**
+ * @brief Queue one operation of a slot, passed to the kernel by the next waitRing()
+ */
+static void submitRing(AsyncIO *io, int index, int stage, const char *path)
+{
+	AsyncSlot *slot = &io->slot[index];
+	unsigned tail = *io->sqTail;
+	unsigned entry = tail & *io->sqMask;
+	struct io_uring_sqe *sqe = (struct io_uring_sqe*)io->sqes+entry;
+
+	memset(sqe, 0, sizeof(*sqe));
+	sqe->user_data = (unsigned long long)index<<3 | stage;
+	switch(stage)
+	{
+	case STAGE_OPEN_IN:
+	case STAGE_OPEN_OUT:
+		sqe->opcode = IORING_OP_OPENAT;
+		sqe->fd = AT_FDCWD;
+		sqe->addr = (unsigned long)path;
+		sqe->open_flags = stage==STAGE_OPEN_IN? O_RDONLY|O_CLOEXEC: O_WRONLY|O_CREAT|O_TRUNC|O_CLOEXEC;
+		sqe->len = 0644;
+		break;
+	case STAGE_READ:
+		sqe->opcode = io->registered? IORING_OP_READ_FIXED: IORING_OP_READ;
+		sqe->fd = slot->fd;
+		sqe->addr = (unsigned long)(slot->input+slot->done);
+		sqe->len = ASYNC_BUFFER_SIZE-slot->done;
+		sqe->off = slot->done;
+		sqe->buf_index = index;
+		break;
+	case STAGE_WRITE:
+		sqe->opcode = io->registered? IORING_OP_WRITE_FIXED: IORING_OP_WRITE;
+		sqe->fd = slot->fd;
+		sqe->addr = (unsigned long)(slot->output+slot->done);
+		sqe->len = slot->length-slot->done;
+		sqe->off = slot->done;
+		sqe->buf_index = io->slots+index;
+		break;
+	default:
+		/*the slot does not wait for its close*/
+		sqe->opcode = IORING_OP_CLOSE;
+		sqe->fd = slot->fd;
+		slot->fd = -1;
+		break;
+	}
+	io->sqArray[entry] = entry;
+	__atomic_store_n(io->sqTail, tail+1, __ATOMIC_RELEASE);
+	io->pending++;
+}
+
+/**
+ * @brief Submit the queued operations and wait for at least one completion
+ * @retval -1 io_uring_enter failed
+ */
+static int waitRing(AsyncIO *io)
+{
+	int ret;
+	do
+		ret = syscall(__NR_io_uring_enter, io->ringFd, io->pending, 1, IORING_ENTER_GETEVENTS, NULL, 0);
+	while(ret < 0 && errno == EINTR);
+	if(ret < 0)
+		return -1;
+	io->pending -= ret;
+	return 0;
+}
+
+/**
+ * @brief Start the next file in a slot
+ */
+static void startSlot(AsyncIO *io, int index, int *next, int count, char *const *inputs)
+{
+	AsyncSlot *slot = &io->slot[index];
+	if(*next >= count)
+	{
+		slot->file = -1;
+		return;
+	}
+	slot->file = (*next)++;
+	slot->done = 0;
+	submitRing(io, index, STAGE_OPEN_IN, inputs[slot->file]);
+}
+
+/**
+ * @brief Advance a slot after one of its operations completed
+ * @return 1 when the slot finished its file, successfully or not
+ */
+static int advanceSlot(AsyncIO *io, int index, int stage, int res, char *const *outputs,
+	AsyncConvert convert, void *context, int *status)
+{
+	AsyncSlot *slot = &io->slot[index];
+	switch(stage)
+	{
+	case STAGE_OPEN_IN:
+	case STAGE_OPEN_OUT:
+		if(res < 0)
+			break;
+		slot->fd = res;
+		slot->done = 0;
+		submitRing(io, index, stage==STAGE_OPEN_IN? STAGE_READ: STAGE_WRITE, NULL);
+		return 0;
+	case STAGE_READ:
+		if(res < 0)
+			break;
+		slot->done += res;
+		if(res > 0 && slot->done < ASYNC_BUFFER_SIZE)
+		{
+			submitRing(io, index, STAGE_READ, NULL);
+			return 0;
+		}
+		submitRing(io, index, STAGE_CLOSE, NULL);
+		if(res > 0)
+			break;
+		/*the other slots' I/O runs while this one converts*/
+		slot->length = convert(slot->input, slot->done, slot->output, ASYNC_BUFFER_SIZE, context);
+		if(slot->length < 0)
+			break;
+		submitRing(io, index, STAGE_OPEN_OUT, outputs[slot->file]);
+		return 0;
+	case STAGE_WRITE:
+		if(res <= 0)
+			break;
+		slot->done += res;
+		if(slot->done < (size_t)slot->length)
+		{
+			submitRing(io, index, STAGE_WRITE, NULL);
+			return 0;
+		}
+		submitRing(io, index, STAGE_CLOSE, NULL);
+		status[slot->file] = 0;
+		return 1;
+	default:
+		return 0;
+	}
+	if(slot->fd >= 0)
+		submitRing(io, index, STAGE_CLOSE, NULL);
+	status[slot->file] = -1;
+	return 1;
+}
+
+/**
+ * @brief The io_uring pipeline of asyncConvertFiles()
+ * @retval -1 the ring failed, status holds what was finished
+ */
+static int convertRing(AsyncIO *io, int count, char *const *inputs, char *const *outputs,
+	AsyncConvert convert, void *context, int *status)
+{
+	struct io_uring_cqe *cqe;
+	unsigned head, tail;
+	int i, active = 0, next = 0;
+
+	for(i=0; i<io->slots; i++)
+	{
+		startSlot(io, i, &next, count, inputs);
+		active += io->slot[i].file >= 0;
+	}
+	while(active > 0)
+	{
+		if(waitRing(io))
+			return -1;
+		head = *io->cqHead;
+		tail = __atomic_load_n(io->cqTail, __ATOMIC_ACQUIRE);
+		for(; head != tail; head++)
+		{
+			cqe = (struct io_uring_cqe*)io->cqes+(head & *io->cqMask);
+			i = cqe->user_data>>3;
+			if(advanceSlot(io, i, cqe->user_data&7, cqe->res, outputs, convert, context, status))
+			{
+				startSlot(io, i, &next, count, inputs);
+				active -= io->slot[i].file < 0;
+			}
+		}
+		__atomic_store_n(io->cqHead, head, __ATOMIC_RELEASE);
+	}
+	/*reap the last closes*/
+	while(io->pending && !waitRing(io))
+		;
+	return 0;
+}
+#endif
+
+#ifndef _WIN32
+/**
+ * @brief The pread/pwrite path of asyncConvertFiles(), one file at a time
+ */
+static void convertPread(AsyncIO *io, int count, char *const *inputs, char *const *outputs,
+	AsyncConvert convert, void *context, int *status)
+{
+	AsyncSlot *slot = &io->slot[0];
+	ssize_t res;
+	int i;
+	for(i=0; i<count; i++)
+	{
+		status[i] = -1;
+		slot->fd = open(inputs[i], O_RDONLY);
+		if(slot->fd < 0)
+			continue;
+		slot->done = 0;
+		do
+			res = pread(slot->fd, slot->input+slot->done, ASYNC_BUFFER_SIZE-slot->done, slot->done);
+		while(res > 0 && (slot->done += res) < ASYNC_BUFFER_SIZE);
+		close(slot->fd);
+		if(res != 0)
+			continue;
+		slot->length = convert(slot->input, slot->done, slot->output, ASYNC_BUFFER_SIZE, context);
+		if(slot->length < 0)
+			continue;
+		slot->fd = open(outputs[i], O_WRONLY|O_CREAT|O_TRUNC, 0644);
+		if(slot->fd < 0)
+			continue;
+		slot->done = 0;
+		do
+			res = pwrite(slot->fd, slot->output+slot->done, slot->length-slot->done, slot->done);
+		while(res > 0 && (slot->done += res) < (size_t)slot->length);
+		close(slot->fd);
+		if(slot->done == (size_t)slot->length)
+			status[i] = 0;
+	}
+	slot->fd = -1;
+}
+#endif
+
+int openAsyncIO(AsyncIO *io, int backend)
+{
+	memset(io, 0, sizeof(AsyncIO));
+	io->ringFd = -1;
+#ifdef _WIN32
+	return -1;
+#else
+#ifdef __linux__
+	if(backend == ASYNC_URING)
+	{
+		io->backend = ASYNC_URING;
+		if(allocSlots(io, ASYNC_QUEUE_DEPTH))
+			return -1;
+		if(!setupRing(io))
+			return ASYNC_URING;
+		closeAsyncIO(io);
+	}
+#endif
+	io->backend = ASYNC_PREAD;
+	if(allocSlots(io, 1))
+		return -1;
+	return ASYNC_PREAD;
+#endif
+}
+
+void closeAsyncIO(AsyncIO *io)
+{
+	int i;
+#ifdef __linux__
+	if(io->sqes)
+		munmap(io->sqes, io->sqesSize);
+	if(io->cqRing && io->cqRing != io->sqRing)
+		munmap(io->cqRing, io->cqRingSize);
+	if(io->sqRing)
+		munmap(io->sqRing, io->sqRingSize);
+	if(io->ringFd >= 0)
+		close(io->ringFd);
+#endif
+	for(i=0; i<io->slots; i++)
+	{
+		free(io->slot[i].input);
+		free(io->slot[i].output);
+	}
+	memset(io, 0, sizeof(AsyncIO));
+	io->ringFd = -1;
+}
+
+int asyncConvertFiles(AsyncIO *io, int count, char *const *inputs, char *const *outputs,
+	AsyncConvert convert, void *context, int *status)
+{
+	int i, failed = 0;
+	for(i=0; i<count; i++)
+		status[i] = -1;
+#ifdef __linux__
+	if(io->backend == ASYNC_URING)
+		convertRing(io, count, inputs, outputs, convert, context, status);
+	else
+#endif
+#ifndef _WIN32
+	if(io->backend == ASYNC_PREAD)
+		convertPread(io, count, inputs, outputs, convert, context, status);
+#endif
+	for(i=0; i<count; i++)
+		failed += status[i] != 0;
+	return failed;
+}
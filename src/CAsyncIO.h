@@ -0,0 +1,123 @@
+/**
+ * @file CAsyncIO.h
+ * @brief Asynchronous file I/O for batch conversion
+ * @author Oneonestar <oneonestar@gmail.com>
+ * @version 1.0
+ * @date 2012-10-27
+ * @copyright 2012 Oneonestar
+ *
+ * @section LICENSE
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _CASYNCIO_
+#define _CASYNCIO_
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/**
+ * @def ASYNC_PREAD
+ * Backend: blocking pread/pwrite, one file at a time
+ */
+#define ASYNC_PREAD 1
+/**
+ * @def ASYNC_URING
+ * Backend: Linux io_uring, ASYNC_QUEUE_DEPTH files in flight
+ */
+#define ASYNC_URING 2
+
+/**
+ * @def ASYNC_QUEUE_DEPTH
+ * Files in flight with io_uring
+ */
+#define ASYNC_QUEUE_DEPTH 16
+
+/**
+ * @def ASYNC_BUFFER_SIZE
+ * Size of every input and output buffer, a 300x300 P2 file is about 360KB
+ */
+#define ASYNC_BUFFER_SIZE (512*1024)
+
+/**
+ * @brief Convert one input file held in memory
+ * @param[in] input the whole input file
+ * @param size bytes of input
+ * @param[out] output buffer for the whole output file
+ * @param capacity size of output
+ * @param context passed through from asyncConvertFiles()
+ * @return bytes of output, -1 on error
+ */
+typedef long (*AsyncConvert)(const unsigned char *input, size_t size, unsigned char *output, size_t capacity, void *context);
+
+/**One file going through the pipeline*/
+typedef struct
+{
+	int file;	/*!< Index into the file list, -1 if the slot is free*/
+	int stage;	/*!< Operation in flight*/
+	int fd;	/*!< Open descriptor, -1 if none*/
+	size_t done;	/*!< Bytes read or written so far*/
+	long length;	/*!< Bytes of output*/
+	unsigned char *input;
+	unsigned char *output;
+}AsyncSlot;
+
+/**
+ * @brief An I/O backend with its buffers
+ * @details With io_uring every slot reads, converts and writes one file, while the other
+ * slots' reads and writes are in flight. Buffers are registered with the kernel when it
+ * allows, so they are not mapped again for every operation.
+ */
+typedef struct
+{
+	int backend;	/*!< ASYNC_PREAD or ASYNC_URING*/
+	int slots;	/*!< Number of slots in use*/
+	AsyncSlot slot[ASYNC_QUEUE_DEPTH];
+	int ringFd;	/*!< io_uring descriptor, -1 for ASYNC_PREAD*/
+	int registered;	/*!< 1 if the buffers are registered*/
+	unsigned pending;	/*!< Submissions not yet passed to the kernel*/
+	void *sqRing;	/*!< Mapped submission ring*/
+	void *cqRing;	/*!< Mapped completion ring*/
+	void *sqes;	/*!< Mapped submission entries*/
+	size_t sqRingSize;
+	size_t cqRingSize;
+	size_t sqesSize;
+	unsigned *sqHead, *sqTail, *sqMask, *sqArray;
+	unsigned *cqHead, *cqTail, *cqMask;
+	void *cqes;
+}AsyncIO;
+
+/**
+ * @brief Set up a backend, io_uring falls back to pread/pwrite when the kernel refuses it
+ * @return the backend in use, -1 if none is available on this system
+ */
+int openAsyncIO(AsyncIO *io, int backend);
+
+/**
+ * @brief Release the ring and the buffers
+ */
+void closeAsyncIO(AsyncIO *io);
+
+/**
+ * @brief Read, convert and write count files
+ * @details Outputs are created only after a successful conversion. Inputs larger than
+ * ASYNC_BUFFER_SIZE fail.
+ * @param[out] status 0 for every converted file, -1 for the others
+ * @return number of failed files
+ */
+int asyncConvertFiles(AsyncIO *io, int count, char *const *inputs, char *const *outputs,
+	AsyncConvert convert, void *context, int *status);
+
+#endif
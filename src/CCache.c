@@ -0,0 +1,255 @@
+/**
+ * @file CCache.c
+ * @brief Content-addressed result cache Implementation
+ * @author Oneonestar <oneonestar@gmail.com>
+ * @version 1.0
+ * @date 2012-10-27
+ * @copyright 2012 Oneonestar
+ *
+ * @section LICENSE
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "CCache.h"
+#include <sys/types.h>
+#include <sys/stat.h>
+#ifdef _WIN32
+#include <direct.h>
+#endif
+
+/*!Magic and version at the start of the index, the layout only: RESULT_VERSION versions the outputs*/
+#define INDEX_MAGIC "RES1"
+
+/*!Buffer size of file copies*/
+#define COPY_BUFFER 65536
+
+static long copyFile(const char *src, const char *dst);
+static void entryPath(const ResultCache *cache, unsigned long long key, char *path);
+static void indexPath(const ResultCache *cache, char *path);
+static void removeEntry(ResultCache *cache, int i);
+
+unsigned long long hashBytes(const void *data, size_t size, unsigned long long seed)
+{
+	const unsigned char *byte = data;
+	unsigned long long hash = seed ^ (size * 0x9E3779B97F4A7C15ULL);
+	unsigned long long word;
+	for(; size>=8; size-=8, byte+=8)
+	{
+		memcpy(&word, byte, 8);
+		hash = (hash ^ word) * 0xBF58476D1CE4E5B9ULL;
+		hash ^= hash >> 31;
+	}
+	word = 0;
+	memcpy(&word, byte, size);
+	hash = (hash ^ word) * 0x94D049BB133111EBULL;
+	/*final mix so every input bit reaches every output bit*/
+	hash ^= hash >> 30;
+	hash *= 0xBF58476D1CE4E5B9ULL;
+	hash ^= hash >> 27;
+	hash *= 0x94D049BB133111EBULL;
+	hash ^= hash >> 31;
+	return hash;
+}
+
+int hashFile(FILE *file, unsigned long long seed, unsigned long long *hash)
+{
+	char buffer[COPY_BUFFER];
+	size_t n;
+	/*COPY_BUFFER is a multiple of 8, only the last block has a tail*/
+	while((n = fread(buffer, 1, sizeof(buffer), file)) > 0)
+		seed = hashBytes(buffer, n, seed);
+	*hash = seed;
+	return ferror(file)? -1: 0;
+}
+
+/*return bytes copied, -1 on error*/
+static long copyFile(const char *src, const char *dst)
+{
+	char buffer[COPY_BUFFER];
+	FILE *in, *out;
+	size_t n;
+	long total = 0;
+	int ok = 1;
+	in = fopen(src, "rb");
+	if(in == NULL)
+		return -1;
+	out = fopen(dst, "wb");
+	if(out == NULL)
+	{
+		fclose(in);
+		return -1;
+	}
+	while(ok && (n = fread(buffer, 1, sizeof(buffer), in)) > 0)
+	{
+		ok = fwrite(buffer, 1, n, out) == n;
+		total += n;
+	}
+	ok = ok && !ferror(in);
+	fclose(in);
+	if(fclose(out) || !ok)
+	{
+		remove(dst);
+		return -1;
+	}
+	return total;
+}
+
+static void entryPath(const ResultCache *cache, unsigned long long key, char *path)
+{
+	sprintf(path, "%.*s/%016llx.res", FILENAME_MAX-22, cache->dir, key);
+}
+
+static void indexPath(const ResultCache *cache, char *path)
+{
+	sprintf(path, "%.*s/index", FILENAME_MAX-7, cache->dir);
+}
+
+static void removeEntry(ResultCache *cache, int i)
+{
+	char path[FILENAME_MAX];
+	entryPath(cache, cache->entry[i].key, path);
+	remove(path);
+	cache->bytes -= cache->entry[i].size;
+	cache->entry[i] = cache->entry[--cache->count];
+}
+
+int openResultCache(ResultCache *cache, const char *dir, unsigned long maxBytes)
+{
+	char path[FILENAME_MAX];
+	char magic[sizeof(INDEX_MAGIC)];
+	struct stat info;
+	FILE *file;
+	int i, ok;
+	if(strlen(dir) >= FILENAME_MAX-22)
+		return -1;
+	memset(cache, 0, sizeof(ResultCache));
+	strcpy(cache->dir, dir);
+	cache->maxBytes = maxBytes;
+#ifdef _WIN32
+	_mkdir(dir);
+#else
+	mkdir(dir, 0755);
+#endif
+	if(stat(dir, &info) || !(info.st_mode & S_IFDIR))
+		return -1;
+
+	indexPath(cache, path);
+	file = fopen(path, "rb");
+	if(file == NULL)
+		return 0;	/*new cache*/
+	ok = fread(magic, sizeof(magic), 1, file) == 1 && !memcmp(magic, INDEX_MAGIC, sizeof(magic))
+		&& fread(&cache->clock, sizeof(cache->clock), 1, file) == 1
+		&& fread(&cache->count, sizeof(cache->count), 1, file) == 1
+		&& cache->count>=0 && cache->count<=MAX_CACHE_ENTRIES
+		&& (cache->count==0 || fread(cache->entry, sizeof(CacheEntry), cache->count, file) == (size_t)cache->count);
+	fclose(file);
+	if(!ok)
+		cache->count = 0;	/*broken index, start again*/
+	for(i=0; i<cache->count; i++)
+		cache->bytes += cache->entry[i].size;
+	/*maxBytes may be smaller than last time*/
+	while(cache->bytes > cache->maxBytes)
+	{
+		int oldest = 0;
+		for(i=1; i<cache->count; i++)
+			if(cache->entry[i].lastUse < cache->entry[oldest].lastUse)
+				oldest = i;
+		removeEntry(cache, oldest);
+		cache->evictions++;
+	}
+	return 0;
+}
+
+int closeResultCache(ResultCache *cache)
+{
+	char path[FILENAME_MAX];
+	FILE *file;
+	int ok;
+	indexPath(cache, path);
+	file = fopen(path, "wb");
+	if(file == NULL)
+		return -1;
+	ok = fwrite(INDEX_MAGIC, sizeof(INDEX_MAGIC), 1, file) == 1
+		&& fwrite(&cache->clock, sizeof(cache->clock), 1, file) == 1
+		&& fwrite(&cache->count, sizeof(cache->count), 1, file) == 1
+		&& (cache->count==0 || fwrite(cache->entry, sizeof(CacheEntry), cache->count, file) == (size_t)cache->count);
+	if(fclose(file) || !ok)
+	{
+		remove(path);
+		return -1;
+	}
+	return 0;
+}
+
+int lookupResultCache(ResultCache *cache, unsigned long long key, const char *fileName)
+{
+	char path[FILENAME_MAX];
+	int i;
+	for(i=0; i<cache->count; i++)
+		if(cache->entry[i].key == key)
+			break;
+	if(i == cache->count)
+	{
+		cache->misses++;
+		return -1;
+	}
+	entryPath(cache, key, path);
+	if(copyFile(path, fileName) != (long)cache->entry[i].size)
+	{
+		/*entry file lost or damaged*/
+		removeEntry(cache, i);
+		cache->misses++;
+		return -1;
+	}
+	cache->entry[i].lastUse = ++cache->clock;
+	cache->hits++;
+	return 0;
+}
+
+int storeResultCache(ResultCache *cache, unsigned long long key, const char *fileName)
+{
+	char path[FILENAME_MAX];
+	struct stat info;
+	int i, oldest;
+	long size;
+	if(stat(fileName, &info) || (unsigned long)info.st_size > cache->maxBytes)
+		return -1;
+	for(i=0; i<cache->count; i++)
+		if(cache->entry[i].key == key)
+		{
+			removeEntry(cache, i);
+			break;
+		}
+	/*least recently used go first*/
+	while(cache->count>0 && (cache->count==MAX_CACHE_ENTRIES || cache->bytes + info.st_size > cache->maxBytes))
+	{
+		oldest = 0;
+		for(i=1; i<cache->count; i++)
+			if(cache->entry[i].lastUse < cache->entry[oldest].lastUse)
+				oldest = i;
+		removeEntry(cache, oldest);
+		cache->evictions++;
+	}
+	entryPath(cache, key, path);
+	size = copyFile(fileName, path);
+	if(size < 0)
+		return -1;
+	cache->entry[cache->count].key = key;
+	cache->entry[cache->count].size = size;
+	cache->entry[cache->count].lastUse = ++cache->clock;
+	cache->count++;
+	cache->bytes += size;
+	return 0;
+}
@@ -0,0 +1,118 @@
+/**
+ * @file CCache.h
+ * @brief Content-addressed result cache for batch processing
+ * @author Oneonestar <oneonestar@gmail.com>
+ * @version 1.0
+ * @date 2012-10-27
+ * @copyright 2012 Oneonestar
+ *
+ * @section LICENSE
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _CCACHE_
+#define _CCACHE_
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/**
+ * @def MAX_CACHE_ENTRIES
+ * Max results kept in one cache directory
+ */
+#define MAX_CACHE_ENTRIES 1024
+
+/**
+ * @def DEF_RESULT_CACHE_DIR
+ * Default directory of the result cache
+ */
+#define DEF_RESULT_CACHE_DIR ".pgmresult"
+
+/**
+ * @def RESULT_VERSION
+ * Version of the effect outputs, seeds every cache key. Bump it whenever an effect
+ * gives a different output, so entries of the older code miss.
+ */
+#define RESULT_VERSION 2ULL
+
+/**One cached output file*/
+typedef struct
+{
+	unsigned long long key;	/*!< Hash of the input file and the effect chain*/
+	unsigned long size;	/*!< Bytes of the output file*/
+	unsigned long long lastUse;	/*!< Cache clock at the last lookup or store, for LRU*/
+}CacheEntry;
+
+/**
+ * @brief Output files indexed by a hash of their input and effect chain
+ * @details The size of all entries is kept under maxBytes by dropping the least
+ * recently used. The index is read by openResultCache() and written back by
+ * closeResultCache().
+ */
+typedef struct
+{
+	char dir[FILENAME_MAX];
+	unsigned long maxBytes;
+	unsigned long bytes;	/*!< Total size of the entries*/
+	unsigned long long clock;
+	unsigned long hits;
+	unsigned long misses;
+	unsigned long evictions;
+	int count;
+	CacheEntry entry[MAX_CACHE_ENTRIES];
+}ResultCache;
+
+/**
+ * @brief Fast 64-bit hash, 8 bytes per step
+ * @param seed chain hashes by passing the previous result
+ */
+unsigned long long hashBytes(const void *data, size_t size, unsigned long long seed);
+
+/**
+ * @brief hashBytes() of a whole file, read in blocks from the current position
+ * @retval 0 success
+ * @retval -1 read error
+ */
+int hashFile(FILE *file, unsigned long long seed, unsigned long long *hash);
+
+/**
+ * @brief Open (and create if needed) the cache in dir
+ * @retval 0 success
+ * @retval -1 cannot create dir
+ */
+int openResultCache(ResultCache *cache, const char *dir, unsigned long maxBytes);
+
+/**
+ * @brief Write the index back
+ * @retval 0 success
+ * @retval -1 cannot write the index
+ */
+int closeResultCache(ResultCache *cache);
+
+/**
+ * @brief Copy the cached output of key to fileName
+ * @retval 0 hit
+ * @retval -1 miss
+ */
+int lookupResultCache(ResultCache *cache, unsigned long long key, const char *fileName);
+
+/**
+ * @brief Keep a copy of the output file fileName under key
+ * @retval 0 success
+ * @retval -1 not stored (larger than the cache or cannot write)
+ */
+int storeResultCache(ResultCache *cache, unsigned long long key, const char *fileName);
+
+#endif
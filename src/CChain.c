@@ -0,0 +1,257 @@
+/**
+ * @file CChain.c
+ * @brief Effect chains Implementation
+ * @author Oneonestar <oneonestar@gmail.com>
+ * @version 1.0
+ * @date 2012-10-27
+ * @copyright 2012 Oneonestar
+ *
+ * @section LICENSE
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "CChain.h"
+
+/*!Number of integer parameters of each effect kind*/
+#define ARGS_NONE 0
+#define ARGS_SIZE 2
+#define ARGS_RADIUS 1
+#define ARGS_TEXT -1
+
+/*!Largest parameter accepted by the parser, the effects check their own range*/
+#define MAX_EFFECT_ARG (DEF_MAX_PIXEL_W>DEF_MAX_PIXEL_H?DEF_MAX_PIXEL_W:DEF_MAX_PIXEL_H)
+
+/**Name and parameters of an effect*/
+typedef struct
+{
+	const char *name;
+	int args;
+}EffectInfo;
+
+enum
+{
+	EFFECT_NEGATIVE, EFFECT_HFLIP, EFFECT_VFLIP, EFFECT_ROTATE90C, EFFECT_ROTATE90CC, EFFECT_ROTATE180,
+	EFFECT_ERODE, EFFECT_DILATE, EFFECT_OPEN, EFFECT_CLOSE, EFFECT_TOPHAT, EFFECT_BLACKHAT,
+	EFFECT_BLUR, EFFECT_SAUVOLA, EFFECT_NIBLACK, EFFECT_MEDIAN, EFFECT_MARK, EFFECT_COUNT
+};
+
+/*!Indexed by the enum above*/
+static const EffectInfo effectTable[EFFECT_COUNT] =
+{
+	{"negative", ARGS_NONE}, {"hflip", ARGS_NONE}, {"vflip", ARGS_NONE},
+	{"rotate90c", ARGS_NONE}, {"rotate90cc", ARGS_NONE}, {"rotate180", ARGS_NONE},
+	{"erode", ARGS_SIZE}, {"dilate", ARGS_SIZE}, {"open", ARGS_SIZE},
+	{"close", ARGS_SIZE}, {"tophat", ARGS_SIZE}, {"blackhat", ARGS_SIZE},
+	{"blur", ARGS_RADIUS}, {"sauvola", ARGS_RADIUS}, {"niblack", ARGS_RADIUS},
+	{"median", ARGS_RADIUS}, {"mark", ARGS_TEXT}
+};
+
+static int parseEffectOp(char *text, EffectOp *op);
+
+/*parse one "name:arg:arg" token, spaces already removed*/
+static int parseEffectOp(char *text, EffectOp *op)
+{
+	char *field = strchr(text, ':');
+	char *end;
+	int i, args;
+	long value;
+	memset(op, 0, sizeof(EffectOp));
+	if(field)
+		*field++ = '\0';
+	for(op->effect=0; op->effect<EFFECT_COUNT; op->effect++)
+		if(!strcmp(text, effectTable[op->effect].name))
+			break;
+	if(op->effect == EFFECT_COUNT)
+		return -1;
+	args = effectTable[op->effect].args;
+	if(args == ARGS_TEXT)
+	{
+		if(field==NULL || strlen(field)==0 || strlen(field)>MAX_MARK_LENGTH || strspn(field, "0123456789")!=strlen(field))
+			return -1;
+		strcpy(op->text, field);
+		return 0;
+	}
+	for(i=0; i<args; i++)
+	{
+		if(field == NULL)
+			return -1;
+		value = strtol(field, &end, 10);
+		if(end==field || (*end!='\0' && *end!=':') || value<0 || value>MAX_EFFECT_ARG)
+			return -1;
+		op->arg[i] = value;
+		field = *end? end+1: NULL;
+	}
+	return field? -1: 0;	/*too many parameters*/
+}
+
+int parseEffectChain(const char *text, EffectChain *chain)
+{
+	char buffer[MAX_CHAIN_TEXT];
+	char *token, *dst = buffer;
+	memset(chain, 0, sizeof(EffectChain));
+	/*drop spaces*/
+	for(; *text; text++)
+	{
+		if(isspace((unsigned char)*text))
+			continue;
+		if(dst == buffer + sizeof(buffer) - 1)
+			return -1;
+		*dst++ = tolower((unsigned char)*text);
+	}
+	*dst = '\0';
+	for(token=strtok(buffer, ","); token; token=strtok(NULL, ","))
+	{
+		if(chain->length == MAX_CHAIN_LENGTH || parseEffectOp(token, &chain->op[chain->length]))
+			return -1;
+		chain->length++;
+	}
+	return chain->length? 0: -1;
+}
+
+void encodeEffectChain(const EffectChain *chain, char *buffer)
+{
+	int i, j;
+	const EffectOp *op;
+	*buffer = '\0';
+	for(i=0; i<chain->length; i++)
+	{
+		op = &chain->op[i];
+		buffer += sprintf(buffer, i? ",%s": "%s", effectTable[op->effect].name);
+		if(effectTable[op->effect].args == ARGS_TEXT)
+			buffer += sprintf(buffer, ":%s", op->text);
+		for(j=0; j<effectTable[op->effect].args; j++)
+			buffer += sprintf(buffer, ":%d", op->arg[j]);
+	}
+}
+
+int applyEffectChain(PGM *image, const EffectChain *chain, Scratch *scratch)
+{
+	int i, status;
+	const EffectOp *op;
+	for(i=0; i<chain->length; i++)
+	{
+		op = &chain->op[i];
+		status = 0;
+		switch(op->effect)
+		{
+			case EFFECT_NEGATIVE:
+				negative(image);
+				break;
+			case EFFECT_HFLIP:
+				horizontalFlip(image);
+				break;
+			case EFFECT_VFLIP:
+				verticalFlip(image);
+				break;
+			case EFFECT_ROTATE90C:
+				status = rotate90C(image, scratch);
+				break;
+			case EFFECT_ROTATE90CC:
+				/*same as rotate 90 clockwise after rotate 180*/
+				horizontalFlip(image);
+				verticalFlip(image);
+				status = rotate90C(image, scratch);
+				break;
+			case EFFECT_ROTATE180:
+				horizontalFlip(image);
+				verticalFlip(image);
+				break;
+			case EFFECT_ERODE:
+				status = erode(image, op->arg[0], op->arg[1], scratch);
+				break;
+			case EFFECT_DILATE:
+				status = dilate(image, op->arg[0], op->arg[1], scratch);
+				break;
+			case EFFECT_OPEN:
+				status = opening(image, op->arg[0], op->arg[1], scratch);
+				break;
+			case EFFECT_CLOSE:
+				status = closing(image, op->arg[0], op->arg[1], scratch);
+				break;
+			case EFFECT_TOPHAT:
+				status = topHat(image, op->arg[0], op->arg[1], scratch);
+				break;
+			case EFFECT_BLACKHAT:
+				status = blackHat(image, op->arg[0], op->arg[1], scratch);
+				break;
+			case EFFECT_BLUR:
+				status = boxBlur(image, op->arg[0], scratch);
+				break;
+			case EFFECT_SAUVOLA:
+				status = adaptiveThreshold(image, op->arg[0], 0.34, THRESHOLD_SAUVOLA, scratch);
+				break;
+			case EFFECT_NIBLACK:
+				status = adaptiveThreshold(image, op->arg[0], -0.2, THRESHOLD_NIBLACK, scratch);
+				break;
+			case EFFECT_MEDIAN:
+				status = medianFilter(image, op->arg[0], scratch);
+				break;
+			case EFFECT_MARK:
+				status = embedInfoPGM(image, (char*)op->text)? -1: 0;
+				break;
+		}
+		if(status)
+			return -1;
+	}
+	return 0;
+}
+
+int isPackedEffectChain(const EffectChain *chain)
+{
+	int i;
+	/*the packed effects come first in the enum*/
+	for(i=0; i<chain->length; i++)
+		if(chain->op[i].effect > EFFECT_ROTATE180)
+			return 0;
+	return 1;
+}
+
+int applyEffectChainPacked(PackedPGM *image, const EffectChain *chain, Scratch *scratch)
+{
+	int i, status;
+	for(i=0; i<chain->length; i++)
+	{
+		status = 0;
+		switch(chain->op[i].effect)
+		{
+			case EFFECT_NEGATIVE:
+				negativePacked(image);
+				break;
+			case EFFECT_HFLIP:
+				horizontalFlipPacked(image);
+				break;
+			case EFFECT_VFLIP:
+				verticalFlipPacked(image);
+				break;
+			case EFFECT_ROTATE90C:
+				status = rotate90CPacked(image, scratch);
+				break;
+			case EFFECT_ROTATE90CC:
+				horizontalFlipPacked(image);
+				verticalFlipPacked(image);
+				status = rotate90CPacked(image, scratch);
+				break;
+			case EFFECT_ROTATE180:
+				horizontalFlipPacked(image);
+				verticalFlipPacked(image);
+				break;
+			default:
+				status = -1;
+		}
+		if(status)
+			return -1;
+	}
+	return 0;
+}
@@ -0,0 +1,98 @@
+/**
+ * @file CChain.h
+ * @brief Effect chains for batch processing of PGM(P2) images
+ * @author Oneonestar <oneonestar@gmail.com>
+ * @version 1.0
+ * @date 2012-10-27
+ * @copyright 2012 Oneonestar
+ *
+ * @section LICENSE
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _CCHAIN_
+#define _CCHAIN_
+#include "CPGM.h"
+
+/**
+ * @def MAX_CHAIN_LENGTH
+ * Max number of effects in one chain
+ */
+#define MAX_CHAIN_LENGTH 16
+
+/**
+ * @def MAX_MARK_LENGTH
+ * Max digits embedded by a "mark" effect
+ */
+#define MAX_MARK_LENGTH 32
+
+/**One effect of a chain with its parameters*/
+typedef struct
+{
+	int effect;	/*!< Index into the effect table*/
+	int arg[2];	/*!< Integer parameters, unused ones are 0*/
+	char text[MAX_MARK_LENGTH+1];	/*!< Digits for "mark", empty otherwise*/
+}EffectOp;
+
+/**A sequence of effects applied in order*/
+typedef struct
+{
+	int length;
+	EffectOp op[MAX_CHAIN_LENGTH];
+}EffectChain;
+
+/**
+ * @brief Parse a chain like "negative,rotate90c,erode:3:3,mark:32110552020"
+ * @details Effects: negative, hflip, vflip, rotate90c, rotate90cc, rotate180,
+ * erode:w:h, dilate:w:h, open:w:h, close:w:h, tophat:w:h, blackhat:w:h,
+ * blur:r, sauvola:r, niblack:r, median:r, mark:digits. Spaces are ignored.
+ * @retval 0 success
+ * @retval -1 syntax error or unknown effect
+ */
+int parseEffectChain(const char *text, EffectChain *chain);
+
+/**
+ * @brief Canonical text of a chain, equal chains give equal text
+ * @param[out] buffer at least MAX_CHAIN_TEXT characters
+ */
+void encodeEffectChain(const EffectChain *chain, char *buffer);
+
+/**
+ * @def MAX_CHAIN_TEXT
+ * Longest canonical text of a chain
+ */
+#define MAX_CHAIN_TEXT (MAX_CHAIN_LENGTH*(MAX_MARK_LENGTH+32))
+
+/**
+ * @brief Apply every effect of the chain in order
+ * @retval 0 success
+ * @retval -1 an effect failed, the image may be partly processed
+ */
+int applyEffectChain(PGM *image, const EffectChain *chain, Scratch *scratch);
+
+/**
+ * @brief Whether every effect of the chain works on PackedPGM
+ * @details negative, hflip, vflip and the rotations.
+ */
+int isPackedEffectChain(const EffectChain *chain);
+
+/**
+ * @brief Apply a chain to a packed image, see isPackedEffectChain()
+ * @retval 0 success
+ * @retval -1 an effect failed or is not available packed
+ */
+int applyEffectChainPacked(PackedPGM *image, const EffectChain *chain, Scratch *scratch);
+
+#endif
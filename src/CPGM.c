@@ -22,13 +22,46 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 #include "CPGM.h"
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
 
 #define MAX_FILE_BUFFER 255
 
+/*!Longest row or column an image can have*/
+#define MAX_LINE_LENGTH (DEF_MAX_PIXEL_W>DEF_MAX_PIXEL_H?DEF_MAX_PIXEL_W:DEF_MAX_PIXEL_H)
+
+/*!Alignment of every scratch allocation, enough for SSE2 loads*/
+#define SCRATCH_ALIGN 16
+
+/*!Rows per band of comparePGM, the unit of parallel work*/
+#define COMPARE_TILE_ROWS 32
+
+/*!Largest median radius, keeps a window count within unsigned short*/
+#define MAX_MEDIAN_RADIUS 127
+
+/*!Clamp a coordinate into [0, n-1], i.e. replicate the border*/
+#define CLAMP_COORD(i, n) ((i)<0? 0: ((i)>=(n)? (n)-1: (i)))
+
 /*!Null PGM*/
 static const PGM nullImg={"", -1, -1, -1, {0}};
 
 static int readNum(FILE* file);
+static void morphLine(const unsigned char *src, unsigned char *dst, int n, int k, int anchor, int isMax);
+static void morphRows(unsigned char *pixel, int width, int height, int k, int isMax, int reflect);
+static void transpose(const unsigned char *src, unsigned char *dst, int width, int height);
+static int morph(PGM *image, int seWidth, int seHeight, int isMax, int reflect, Scratch *scratch);
+static int clipRect(const IntegralPGM *table, int *x, int *y, int *w, int *h);
+static int median3x3(PGM *image, Scratch *scratch);
+static void histAdd(unsigned short *dst, const unsigned short *src);
+static void histSub(unsigned short *dst, const unsigned short *src);
+static unsigned char reverseFields(unsigned char b, int bits);
+static void flipRowFields(unsigned char *row, int rowBytes, int width, int bits);
+static void rotateFields(const unsigned char *src, unsigned char *dst, int width, int height, int bits);
+static int readHeaderPGM(FILE *file, int *width, int *height, int *greyMax);
+static void packRow(const unsigned char *src, unsigned char *dst, int width, int bits);
+static void unpackRow(const unsigned char *src, unsigned char *dst, int width, int bits);
+static void compareRow(const unsigned char *a, const unsigned char *b, int width, long *count, unsigned long long *sse, int *maxError);
 
 static int readNum(FILE* file)
 {
@@ -76,12 +109,10 @@ void setNullPGM(PGM *image)
 	memcpy(image, &nullImg, sizeof(PGM));
 }
 
-int readFilePGM(FILE *file, PGM *image)
+/*parse the header up to greyMax, 0 if valid*/
+static int readHeaderPGM(FILE *file, int *width, int *height, int *greyMax)
 {
-    PGM tempImg;
-    int i;
 	char c;
-	int temp;
 	/*first line*/
 	c = fgetc(file);
 	if(c!='P')
@@ -120,26 +151,49 @@ int readFilePGM(FILE *file, PGM *image)
 
 	
 	/*width and height and greyMax*/
-	tempImg.width = readNum(file);
-	tempImg.height = readNum(file);
-	tempImg.greyMax = readNum(file);
-	if(tempImg.width<0 || tempImg.height<0 || tempImg.greyMax<=0)
+	*width = readNum(file);
+	*height = readNum(file);
+	*greyMax = readNum(file);
+	if(*width<0 || *height<0 || *greyMax<=0)
 		return -1;
-	if(tempImg.width>300 || tempImg.height>300 || tempImg.greyMax>255)
+	if(*width>300 || *height>300 || *greyMax>255)
+		return -1;
+	return 0;
+}
+
+int readFilePGM(FILE *file, PGM *image, Scratch *scratch)
+{
+	int width, height, greyMax;
+	unsigned char *pixel;
+	size_t mark;
+    int i;
+	int temp;
+	if(readHeaderPGM(file, &width, &height, &greyMax))
 		return -1;
 
 	/*read pixel*/
-	for (i=0; i< tempImg.width * tempImg.height; i++)
+	mark = scratchMark(scratch);
+	pixel = scratchAlloc(scratch, width*height);
+	if(pixel == NULL)
+		return -1;
+	for (i=0; i< width * height; i++)
 	{
         temp = readNum(file);
 		if(temp<0)
+		{
+			scratchRelease(scratch, mark);
 			return -1;
-		tempImg.pixelData[i] = temp;
+		}
+		pixel[i] = temp;
 	}
 	
 	/*store the correct image into program*/
-	reset(image);
-    memcpy(image, &tempImg, sizeof(PGM));
+	image->comment[0] = '\0';
+	image->width = width;
+	image->height = height;
+	image->greyMax = greyMax;
+	memcpy(image->pixelData, pixel, width*height);
+	scratchRelease(scratch, mark);
 	return 0;
 }
 
@@ -154,7 +208,7 @@ int writeFilePGM(FILE *file, const PGM *image, int useGroupComment)
     fprintf(file, "%d %d\n", image->width, image->height);
     fprintf(file, "%d\n", image->greyMax);
     printPixelPGM(file, image, NULL);
-	return 0;
+	return ferror(file)? -1: 0;
 }
 
 
@@ -220,6 +274,75 @@ void reset(PGM *image)
     memset(image, 0, sizeof(PGM));
 }
 
+void initScratch(Scratch *scratch)
+{
+	memset(scratch, 0, sizeof(Scratch));
+}
+
+void freeScratch(Scratch *scratch)
+{
+	scratchRelease(scratch, 0);
+	free(scratch->data);
+	initScratch(scratch);
+}
+
+void *scratchAlloc(Scratch *scratch, size_t size)
+{
+	void *block;
+	size = (size + SCRATCH_ALIGN - 1) / SCRATCH_ALIGN * SCRATCH_ALIGN;
+	if(size == 0)
+		size = SCRATCH_ALIGN;	/*empty images still get a valid pointer*/
+	/*nothing handed out yet => the block can simply grow*/
+	if(scratch->used == 0 && scratch->heapCount == 0 && size > scratch->size)
+	{
+		free(scratch->data);
+		scratch->data = malloc(size);
+		scratch->size = scratch->data? size: 0;
+		if(scratch->data == NULL)
+			return NULL;
+	}
+	if(scratch->used + size <= scratch->size)
+	{
+		block = scratch->data + scratch->used;
+		scratch->used += size;
+	}
+	else
+	{
+		/*block is full, borrow from the heap until the next full release*/
+		if(scratch->heapCount == MAX_SCRATCH_HEAP || (block = malloc(size)) == NULL)
+			return NULL;
+		scratch->heap[scratch->heapCount++] = block;
+		scratch->heapUsed += size;
+	}
+	if(scratch->used + scratch->heapUsed > scratch->peak)
+		scratch->peak = scratch->used + scratch->heapUsed;
+	return block;
+}
+
+size_t scratchMark(const Scratch *scratch)
+{
+	return scratch->used;
+}
+
+void scratchRelease(Scratch *scratch, size_t mark)
+{
+	int i;
+	scratch->used = mark;
+	if(mark > 0)
+		return;
+	/*full release: give back the heap blocks and grow so they are not needed next time*/
+	for(i=0; i<scratch->heapCount; i++)
+		free(scratch->heap[i]);
+	scratch->heapCount = 0;
+	scratch->heapUsed = 0;
+	if(scratch->peak > scratch->size)
+	{
+		free(scratch->data);
+		scratch->data = malloc(scratch->peak);
+		scratch->size = scratch->data? scratch->peak: 0;
+	}
+}
+
 
 void negative(PGM *image)
 {
@@ -233,44 +356,1138 @@ void negative(PGM *image)
 void horizontalFlip(PGM *image)
 {
 	int h, w;
-	PGM tempImg;
-	memcpy(&tempImg, image, sizeof(PGM));
-	/*flip*/
+	unsigned char temp;
+	/*swap in place, no temporary image*/
 	for(h=0; h < image->height; h++)
-		for(w=0; w < image->width; w++)
-			tempImg.pixelData[h*image->width + w] = image->pixelData[(image->width - w) + h*image->width];
-	/*copy back*/		
-	reset(image);
-    memcpy(image, &tempImg, sizeof(PGM));
+	{
+		unsigned char *row = image->pixelData + h*image->width;
+		for(w=0; w < image->width/2; w++)
+		{
+			temp = row[w];
+			row[w] = row[image->width-1-w];
+			row[image->width-1-w] = temp;
+		}
+	}
 }
 
 void verticalFlip(PGM *image)
 {
 	int h, w;
-	PGM tempImg;
-	memcpy(&tempImg, image, sizeof(PGM));
-	/*flip*/
-	for(h=0; h < image->height; h++)
+	unsigned char temp;
+	/*swap in place, no temporary image*/
+	for(h=0; h < image->height/2; h++)
+	{
+		unsigned char *top = image->pixelData + h*image->width;
+		unsigned char *bottom = image->pixelData + (image->height-1-h)*image->width;
 		for(w=0; w < image->width; w++)
-			tempImg.pixelData[h*image->width + w] = image->pixelData[(image->height - h)*image->width + w];
-	/*copyback*/
-	reset(image);
-    memcpy(image, &tempImg, sizeof(PGM));
+		{
+			temp = top[w];
+			top[w] = bottom[w];
+			bottom[w] = temp;
+		}
+	}
 }
 
-void rotate90C(PGM *image)
+int rotate90C(PGM *image, Scratch *scratch)
 {
 	int h, w;
-	PGM tempImg;
-	memcpy(&tempImg, image, sizeof(PGM));
-	tempImg.height = image->width;
-	tempImg.width = image->height;
+	size_t mark = scratchMark(scratch);
+	unsigned char *temp = scratchAlloc(scratch, image->width*image->height);
+	if(temp == NULL)
+		return -1;
 	/*rotate*/
 	for(h=0; h < image->height; h++)
 		for(w=0; w < image->width; w++)
-			tempImg.pixelData[w*tempImg.width + tempImg.width-h-1] = image->pixelData[h*image->width + w];
+			temp[w*image->height + image->height-h-1] = image->pixelData[h*image->width + w];
 	/*copyback*/
-	reset(image);
-    memcpy(image, &tempImg, sizeof(PGM));
+	memcpy(image->pixelData, temp, image->width*image->height);
+	h = image->height;
+	image->height = image->width;
+	image->width = h;
+	scratchRelease(scratch, mark);
+	return 0;
 }
 
+/*
+ * Running min/max of a window of k pixels over a line of n pixels (van Herk/Gil-Werman).
+ * The padded line is cut into blocks of k; g holds the prefix min/max inside each block
+ * and h the suffix min/max, so every window is op(h[x], g[x+k-1]) whatever k is.
+ * The window starts anchor pixels before the pixel. src and dst may be the same line.
+ */
+static void morphLine(const unsigned char *src, unsigned char *dst, int n, int k, int anchor, int isMax)
+{
+	unsigned char buf[3*MAX_LINE_LENGTH];
+	unsigned char g[3*MAX_LINE_LENGTH];
+	unsigned char h[3*MAX_LINE_LENGTH];
+	unsigned char pad = isMax? 0: 255;	/*identity of the operation*/
+	int len = n + k - 1;
+	int i, x;
+	len = (len + k - 1) / k * k;	/*round up to whole blocks*/
+
+	memset(buf, pad, len);
+	memcpy(buf + anchor, src, n);
+
+	for(i=0; i<len; i++)
+	{
+		if(i%k == 0)
+			g[i] = buf[i];
+		else if(isMax)
+			g[i] = buf[i]>g[i-1]? buf[i]: g[i-1];
+		else
+			g[i] = buf[i]<g[i-1]? buf[i]: g[i-1];
+	}
+	for(i=len-1; i>=0; i--)
+	{
+		if(i%k == k-1)
+			h[i] = buf[i];
+		else if(isMax)
+			h[i] = buf[i]>h[i+1]? buf[i]: h[i+1];
+		else
+			h[i] = buf[i]<h[i+1]? buf[i]: h[i+1];
+	}
+
+	/*merge the two halves of every window*/
+	x = 0;
+#if defined(__SSE2__)
+	for(; x+16<=n; x+=16)
+	{
+		__m128i a = _mm_loadu_si128((const __m128i*)(h + x));
+		__m128i b = _mm_loadu_si128((const __m128i*)(g + x + k - 1));
+		_mm_storeu_si128((__m128i*)(dst + x), isMax? _mm_max_epu8(a, b): _mm_min_epu8(a, b));
+	}
+#endif
+	for(; x<n; x++)
+	{
+		if(isMax)
+			dst[x] = h[x]>g[x+k-1]? h[x]: g[x+k-1];
+		else
+			dst[x] = h[x]<g[x+k-1]? h[x]: g[x+k-1];
+	}
+}
+
+/*
+ * The window is centred on the pixel (anchor k/2), the reflected one is anchored at k-1-k/2.
+ * The two differ for even k only.
+ */
+static void morphRows(unsigned char *pixel, int width, int height, int k, int isMax, int reflect)
+{
+	int h;
+	if(k == 1)
+		return;
+	for(h=0; h<height; h++)
+		morphLine(pixel + h*width, pixel + h*width, width, k, reflect? k-1-k/2: k/2, isMax);
+}
+
+static void transpose(const unsigned char *src, unsigned char *dst, int width, int height)
+{
+	int h, w;
+	for(h=0; h<height; h++)
+		for(w=0; w<width; w++)
+			dst[w*height + h] = src[h*width + w];
+}
+
+static int morph(PGM *image, int seWidth, int seHeight, int isMax, int reflect, Scratch *scratch)
+{
+	unsigned char *temp = NULL;
+	size_t mark = scratchMark(scratch);
+	if(seWidth<1 || seWidth>MAX_LINE_LENGTH || seHeight<1 || seHeight>MAX_LINE_LENGTH)
+		return -1;
+	if(seHeight > 1 && (temp = scratchAlloc(scratch, image->width*image->height)) == NULL)
+		return -1;
+	/*rectangle is separable: rows first, then columns through a transpose*/
+	morphRows(image->pixelData, image->width, image->height, seWidth, isMax, reflect);
+	if(seHeight > 1)
+	{
+		transpose(image->pixelData, temp, image->width, image->height);
+		morphRows(temp, image->height, image->width, seHeight, isMax, reflect);
+		transpose(temp, image->pixelData, image->height, image->width);
+	}
+	scratchRelease(scratch, mark);
+	return 0;
+}
+
+int erode(PGM *image, int seWidth, int seHeight, Scratch *scratch)
+{
+	return morph(image, seWidth, seHeight, 0, 0, scratch);
+}
+
+int dilate(PGM *image, int seWidth, int seHeight, Scratch *scratch)
+{
+	return morph(image, seWidth, seHeight, 1, 0, scratch);
+}
+
+/*
+ * The second pass uses the reflected element, so with even sizes every pixel still lies
+ * in the window it is taken back from: opening <= original <= closing.
+ */
+int opening(PGM *image, int seWidth, int seHeight, Scratch *scratch)
+{
+	if(morph(image, seWidth, seHeight, 0, 0, scratch))
+		return -1;
+	return morph(image, seWidth, seHeight, 1, 1, scratch);
+}
+
+int closing(PGM *image, int seWidth, int seHeight, Scratch *scratch)
+{
+	if(morph(image, seWidth, seHeight, 1, 0, scratch))
+		return -1;
+	return morph(image, seWidth, seHeight, 0, 1, scratch);
+}
+
+int topHat(PGM *image, int seWidth, int seHeight, Scratch *scratch)
+{
+	int i;
+	size_t mark = scratchMark(scratch);
+	unsigned char *original = scratchAlloc(scratch, image->width*image->height);
+	if(original == NULL)
+		return -1;
+	memcpy(original, image->pixelData, image->width*image->height);
+	if(opening(image, seWidth, seHeight, scratch))
+	{
+		scratchRelease(scratch, mark);
+		return -1;
+	}
+	/*opening <= original (reflected dilation), so no underflow*/
+	for(i=0; i<image->width*image->height; i++)
+		image->pixelData[i] = original[i] - image->pixelData[i];
+	scratchRelease(scratch, mark);
+	return 0;
+}
+
+int blackHat(PGM *image, int seWidth, int seHeight, Scratch *scratch)
+{
+	int i;
+	size_t mark = scratchMark(scratch);
+	unsigned char *original = scratchAlloc(scratch, image->width*image->height);
+	if(original == NULL)
+		return -1;
+	memcpy(original, image->pixelData, image->width*image->height);
+	if(closing(image, seWidth, seHeight, scratch))
+	{
+		scratchRelease(scratch, mark);
+		return -1;
+	}
+	/*closing >= original (reflected erosion), so no underflow*/
+	for(i=0; i<image->width*image->height; i++)
+		image->pixelData[i] = image->pixelData[i] - original[i];
+	scratchRelease(scratch, mark);
+	return 0;
+}
+
+
+void integralPGM(const PGM *image, IntegralPGM *table)
+{
+	int h, w;
+	int stride = image->width + 1;
+	unsigned int rowSum;
+	unsigned long long rowSqSum;
+	table->width = image->width;
+	table->height = image->height;
+	memset(table->sum, 0, stride*sizeof(table->sum[0]));
+	memset(table->sqSum, 0, stride*sizeof(table->sqSum[0]));
+	for(h=0; h<image->height; h++)
+	{
+		const unsigned char *row = image->pixelData + h*image->width;
+		unsigned int *sum = table->sum + (h+1)*stride;
+		unsigned long long *sqSum = table->sqSum + (h+1)*stride;
+		rowSum = 0;
+		rowSqSum = 0;
+		sum[0] = 0;
+		sqSum[0] = 0;
+		for(w=0; w<image->width; w++)
+		{
+			rowSum += row[w];
+			rowSqSum += (unsigned int)row[w]*row[w];
+			sum[w+1] = sum[w+1-stride] + rowSum;
+			sqSum[w+1] = sqSum[w+1-stride] + rowSqSum;
+		}
+	}
+}
+
+/*clip the rectangle to the image, return its area*/
+static int clipRect(const IntegralPGM *table, int *x, int *y, int *w, int *h)
+{
+	int x1 = *x + *w, y1 = *y + *h;
+	if(*x < 0)
+		*x = 0;
+	if(*y < 0)
+		*y = 0;
+	if(x1 > table->width)
+		x1 = table->width;
+	if(y1 > table->height)
+		y1 = table->height;
+	if(x1 <= *x || y1 <= *y)
+		return 0;
+	*w = x1 - *x;
+	*h = y1 - *y;
+	return *w * *h;
+}
+
+unsigned int rectSum(const IntegralPGM *table, int x, int y, int w, int h)
+{
+	int stride = table->width + 1;
+	const unsigned int *top, *bottom;
+	if(!clipRect(table, &x, &y, &w, &h))
+		return 0;
+	top = table->sum + y*stride + x;
+	bottom = top + h*stride;
+	return bottom[w] - bottom[0] - top[w] + top[0];
+}
+
+double rectMean(const IntegralPGM *table, int x, int y, int w, int h)
+{
+	int area = clipRect(table, &x, &y, &w, &h);
+	if(!area)
+		return 0;
+	return (double)rectSum(table, x, y, w, h) / area;
+}
+
+double rectVariance(const IntegralPGM *table, int x, int y, int w, int h)
+{
+	int stride = table->width + 1;
+	int area = clipRect(table, &x, &y, &w, &h);
+	const unsigned long long *top, *bottom;
+	double mean, variance;
+	if(!area)
+		return 0;
+	top = table->sqSum + y*stride + x;
+	bottom = top + h*stride;
+	mean = (double)rectSum(table, x, y, w, h) / area;
+	variance = (double)(bottom[w] - bottom[0] - top[w] + top[0]) / area - mean*mean;
+	return variance>0? variance: 0;	/*rounding may give a tiny negative*/
+}
+
+int boxBlur(PGM *image, int radius, Scratch *scratch)
+{
+	int h, w, x, y, bw, bh, area;
+	size_t mark = scratchMark(scratch);
+	IntegralPGM *table;
+	if(radius < 0)
+		return -1;
+	table = scratchAlloc(scratch, sizeof(IntegralPGM));
+	if(table == NULL)
+		return -1;
+	integralPGM(image, table);
+	for(h=0; h<image->height; h++)
+		for(w=0; w<image->width; w++)
+		{
+			x = w - radius;
+			y = h - radius;
+			bw = bh = 2*radius + 1;
+			area = clipRect(table, &x, &y, &bw, &bh);
+			image->pixelData[h*image->width + w] = (rectSum(table, x, y, bw, bh) + area/2) / area;
+		}
+	scratchRelease(scratch, mark);
+	return 0;
+}
+
+int adaptiveThreshold(PGM *image, int radius, double k, int method, Scratch *scratch)
+{
+	int h, w;
+	double mean, deviation, threshold;
+	double range = image->greyMax / 2.0;
+	size_t mark = scratchMark(scratch);
+	IntegralPGM *table;
+	if(radius < 0 || (method != THRESHOLD_SAUVOLA && method != THRESHOLD_NIBLACK))
+		return -1;
+	table = scratchAlloc(scratch, sizeof(IntegralPGM));
+	if(table == NULL)
+		return -1;
+	integralPGM(image, table);
+	for(h=0; h<image->height; h++)
+		for(w=0; w<image->width; w++)
+		{
+			mean = rectMean(table, w-radius, h-radius, 2*radius+1, 2*radius+1);
+			deviation = sqrt(rectVariance(table, w-radius, h-radius, 2*radius+1, 2*radius+1));
+			if(method == THRESHOLD_SAUVOLA)
+				threshold = mean * (1 + k * (deviation / range - 1));
+			else
+				threshold = mean + k * deviation;
+			image->pixelData[h*image->width + w] = image->pixelData[h*image->width + w] > threshold? image->greyMax: 0;
+		}
+	scratchRelease(scratch, mark);
+	return 0;
+}
+
+
+/*compare-exchange, a gets the min and b the max*/
+#define MED_SORT(a, b) { unsigned char t_ = a<b? a: b; b = a<b? b: a; a = t_; }
+#if defined(__SSE2__)
+#define MED_SORT_SSE(a, b) { __m128i t_ = _mm_min_epu8(a, b); b = _mm_max_epu8(a, b); a = t_; }
+#endif
+
+/*median of 9 with the 19 compare-exchange network*/
+#define MED_NETWORK9(SORT, p) \
+	SORT(p[1], p[2]) SORT(p[4], p[5]) SORT(p[7], p[8]) \
+	SORT(p[0], p[1]) SORT(p[3], p[4]) SORT(p[6], p[7]) \
+	SORT(p[1], p[2]) SORT(p[4], p[5]) SORT(p[7], p[8]) \
+	SORT(p[0], p[3]) SORT(p[5], p[8]) SORT(p[4], p[7]) \
+	SORT(p[3], p[6]) SORT(p[1], p[4]) SORT(p[2], p[5]) \
+	SORT(p[4], p[7]) SORT(p[4], p[2]) SORT(p[6], p[4]) \
+	SORT(p[4], p[2])
+
+static int median3x3(PGM *image, Scratch *scratch)
+{
+	int width = image->width, height = image->height;
+	int stride = width + 2;
+	int h, w, i;
+	size_t mark = scratchMark(scratch);
+	unsigned char *padded = scratchAlloc(scratch, (width+2)*(height+2));
+	if(padded == NULL)
+		return -1;
+	/*copy with a replicated one pixel border*/
+	for(h=-1; h<=height; h++)
+		for(w=-1; w<=width; w++)
+			padded[(h+1)*stride + w+1] = image->pixelData[CLAMP_COORD(h, height)*width + CLAMP_COORD(w, width)];
+
+	for(h=0; h<height; h++)
+	{
+		const unsigned char *top = padded + h*stride;
+		unsigned char *dst = image->pixelData + h*width;
+		w = 0;
+#if defined(__SSE2__)
+		for(; w+16<=width; w+=16)
+		{
+			__m128i p[9];
+			for(i=0; i<9; i++)
+				p[i] = _mm_loadu_si128((const __m128i*)(top + (i/3)*stride + w + i%3));
+			MED_NETWORK9(MED_SORT_SSE, p)
+			_mm_storeu_si128((__m128i*)(dst + w), p[4]);
+		}
+#endif
+		for(; w<width; w++)
+		{
+			unsigned char p[9];
+			for(i=0; i<9; i++)
+				p[i] = top[(i/3)*stride + w + i%3];
+			MED_NETWORK9(MED_SORT, p)
+			dst[w] = p[4];
+		}
+	}
+	scratchRelease(scratch, mark);
+	return 0;
+}
+
+static void histAdd(unsigned short *dst, const unsigned short *src)
+{
+	int i = 0;
+#if defined(__SSE2__)
+	for(; i<256; i+=8)
+		_mm_storeu_si128((__m128i*)(dst + i), _mm_add_epi16(_mm_loadu_si128((const __m128i*)(dst + i)),
+			_mm_loadu_si128((const __m128i*)(src + i))));
+#endif
+	for(; i<256; i++)
+		dst[i] += src[i];
+}
+
+static void histSub(unsigned short *dst, const unsigned short *src)
+{
+	int i = 0;
+#if defined(__SSE2__)
+	for(; i<256; i+=8)
+		_mm_storeu_si128((__m128i*)(dst + i), _mm_sub_epi16(_mm_loadu_si128((const __m128i*)(dst + i)),
+			_mm_loadu_si128((const __m128i*)(src + i))));
+#endif
+	for(; i<256; i++)
+		dst[i] -= src[i];
+}
+
+/*
+ * Perreault/Hebert: one histogram per column covers the 2r+1 rows of the window and
+ * slides down one row at a time, the window histogram slides right by adding and
+ * removing one column histogram. Both updates cost O(1) whatever the radius.
+ */
+int medianFilter(PGM *image, int radius, Scratch *scratch)
+{
+	unsigned char *src;
+	unsigned short (*column)[256];
+	unsigned short kernel[256];
+	int width = image->width, height = image->height;
+	int half = (2*radius+1)*(2*radius+1)/2;
+	int h, w, i, count;
+	size_t mark = scratchMark(scratch);
+	if(radius<0 || radius>MAX_MEDIAN_RADIUS)
+		return -1;
+	/*nothing to filter, and the border clamp needs at least one pixel*/
+	if(radius == 0 || width == 0 || height == 0)
+		return 0;
+	if(radius == 1)
+		return median3x3(image, scratch);
+	column = scratchAlloc(scratch, width*sizeof(*column));
+	src = scratchAlloc(scratch, width*height);
+	if(column == NULL || src == NULL)
+	{
+		scratchRelease(scratch, mark);
+		return -1;
+	}
+	memset(column, 0, width*sizeof(*column));
+	memcpy(src, image->pixelData, width*height);
+
+	/*column histograms for the window of row 0*/
+	for(w=0; w<width; w++)
+		for(i=-radius; i<=radius; i++)
+			column[w][src[CLAMP_COORD(i, height)*width + w]]++;
+
+	for(h=0; h<height; h++)
+	{
+		if(h > 0)
+		{
+			int out = CLAMP_COORD(h-radius-1, height)*width;
+			int in = CLAMP_COORD(h+radius, height)*width;
+			for(w=0; w<width; w++)
+			{
+				column[w][src[out + w]]--;
+				column[w][src[in + w]]++;
+			}
+		}
+		memset(kernel, 0, sizeof(kernel));
+		for(i=-radius; i<=radius; i++)
+			histAdd(kernel, column[CLAMP_COORD(i, width)]);
+		for(w=0; w<width; w++)
+		{
+			if(w > 0)
+			{
+				histSub(kernel, column[CLAMP_COORD(w-radius-1, width)]);
+				histAdd(kernel, column[CLAMP_COORD(w+radius, width)]);
+			}
+			count = 0;
+			for(i=0; i<image->greyMax; i++)
+			{
+				count += kernel[i];
+				if(count > half)
+					break;
+			}
+			image->pixelData[h*width + w] = i;
+		}
+	}
+	scratchRelease(scratch, mark);
+	return 0;
+}
+
+
+int otsuThreshold(const PGM *image)
+{
+	/*four partial histograms so consecutive equal pixels do not stall on one counter*/
+	unsigned int partial[4][256];
+	double hist[256];
+	double total = image->width*image->height;
+	double sumAll = 0, sumDark = 0, weightDark = 0, weightLight;
+	double meanDark, meanLight, between, best = -1;
+	int n = image->width*image->height;
+	int i, t, threshold = 0;
+	memset(partial, 0, sizeof(partial));
+	for(i=0; i+4<=n; i+=4)
+	{
+		partial[0][image->pixelData[i]]++;
+		partial[1][image->pixelData[i+1]]++;
+		partial[2][image->pixelData[i+2]]++;
+		partial[3][image->pixelData[i+3]]++;
+	}
+	for(; i<n; i++)
+		partial[0][image->pixelData[i]]++;
+	for(i=0; i<256; i++)
+	{
+		hist[i] = partial[0][i] + partial[1][i] + partial[2][i] + partial[3][i];
+		sumAll += i*hist[i];
+	}
+
+	for(t=0; t<image->greyMax; t++)
+	{
+		weightDark += hist[t];
+		if(weightDark == 0)
+			continue;
+		weightLight = total - weightDark;
+		if(weightLight == 0)
+			break;
+		sumDark += t*hist[t];
+		meanDark = sumDark / weightDark;
+		meanLight = (sumAll - sumDark) / weightLight;
+		between = weightDark * weightLight * (meanDark - meanLight) * (meanDark - meanLight);
+		if(between > best)
+		{
+			best = between;
+			threshold = t;
+		}
+	}
+	return threshold;
+}
+
+/*reverse the order of the bits-wide fields of a byte, bits 1 reverses the bits*/
+static unsigned char reverseFields(unsigned char b, int bits)
+{
+	b = (b & 0xF0) >> 4 | (b & 0x0F) << 4;
+	if(bits <= 2)
+		b = (b & 0xCC) >> 2 | (b & 0x33) << 2;
+	if(bits == 1)
+		b = (b & 0xAA) >> 1 | (b & 0x55) << 1;
+	return b;
+}
+
+/*mirror a packed row, rows start on a byte and padding is at the end*/
+static void flipRowFields(unsigned char *row, int rowBytes, int width, int bits)
+{
+	unsigned char temp[DEF_MAX_PIXEL_W];
+	int shift = rowBytes*8 - width*bits;	/*padding bits, end up in front after the flip*/
+	int i;
+	for(i=0; i<rowBytes; i++)
+		temp[i] = reverseFields(row[rowBytes-1-i], bits);
+	for(i=0; i<rowBytes; i++)
+		row[i] = shift? (temp[i] << shift | (i+1<rowBytes? temp[i+1] >> (8-shift): 0)) & 0xFF: temp[i];
+}
+
+/*rotate a packed image 90 clockwise from src into dst, dst row w is src column w read bottom-up*/
+static void rotateFields(const unsigned char *src, unsigned char *dst, int width, int height, int bits)
+{
+	int srcBytes = (width*bits+7)/8;
+	int dstBytes = (height*bits+7)/8;
+	int perByte = 8/bits;
+	int mask = (1<<bits) - 1;
+	int h, w, i;
+	for(w=0; w<width; w++)
+	{
+		int byte = w*bits/8;
+		int shift = 8 - bits - w*bits%8;
+		for(i=0; i<dstBytes; i++)
+		{
+			unsigned char out = 0;
+			for(h=perByte*i; h<perByte*i+perByte && h<height; h++)
+				out |= ((src[(height-1-h)*srcBytes + byte] >> shift) & mask) << (8 - bits - h*bits%8);
+			dst[w*dstBytes + i] = out;
+		}
+	}
+}
+
+void binarizePGM(const PGM *image, int threshold, PBM *bitmap)
+{
+	int h, w;
+	int rowBytes = PBM_ROW_BYTES(image->width);
+	unsigned char level = threshold<0? 0: (threshold>255? 255: threshold);
+	strcpy(bitmap->comment, image->comment);
+	bitmap->width = image->width;
+	bitmap->height = image->height;
+	memset(bitmap->bitData, 0, rowBytes*image->height);
+	if(threshold < 0)
+		return;	/*nothing is dark*/
+	for(h=0; h<image->height; h++)
+	{
+		const unsigned char *src = image->pixelData + h*image->width;
+		unsigned char *dst = bitmap->bitData + h*rowBytes;
+		w = 0;
+#if defined(__SSE2__)
+		{
+			__m128i limit = _mm_set1_epi8((char)level);
+			for(; w+16<=image->width; w+=16)
+			{
+				__m128i p = _mm_loadu_si128((const __m128i*)(src + w));
+				/*p <= level  <=>  max(p, level) == level*/
+				int mask = _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_max_epu8(p, limit), limit));
+				/*movemask is LSB first, PBM is MSB first*/
+				dst[w/8] = reverseFields(mask & 0xFF, 1);
+				dst[w/8+1] = reverseFields(mask >> 8, 1);
+			}
+		}
+#endif
+		for(; w<image->width; w++)
+			if(src[w] <= level)
+				dst[w/8] |= 0x80 >> (w%8);
+	}
+}
+
+void unpackPBM(const PBM *bitmap, PGM *image)
+{
+	int h, w;
+	int rowBytes = PBM_ROW_BYTES(bitmap->width);
+	strcpy(image->comment, bitmap->comment);
+	image->width = bitmap->width;
+	image->height = bitmap->height;
+	image->greyMax = 1;
+	for(h=0; h<bitmap->height; h++)
+	{
+		const unsigned char *src = bitmap->bitData + h*rowBytes;
+		unsigned char *dst = image->pixelData + h*bitmap->width;
+		w = 0;
+#if defined(__SSE2__)
+		{
+			const __m128i bits = _mm_set_epi8(1, 2, 4, 8, 16, 32, 64, (char)128, 1, 2, 4, 8, 16, 32, 64, (char)128);
+			const __m128i one = _mm_set1_epi8(1);
+			for(; w+16<=bitmap->width; w+=16)
+			{
+				__m128i lo = _mm_set1_epi8((char)src[w/8]);
+				__m128i hi = _mm_set1_epi8((char)src[w/8+1]);
+				__m128i v = _mm_unpacklo_epi64(lo, hi);
+				__m128i black = _mm_cmpeq_epi8(_mm_and_si128(v, bits), bits);
+				_mm_storeu_si128((__m128i*)(dst + w), _mm_andnot_si128(black, one));
+			}
+		}
+#endif
+		for(; w<bitmap->width; w++)
+			dst[w] = !(src[w/8] & (0x80 >> (w%8)));
+	}
+}
+
+int writeFilePBM(FILE *file, const PBM *bitmap, int binary)
+{
+	int h, w;
+	int rowBytes = PBM_ROW_BYTES(bitmap->width);
+	fprintf(file, binary? "P4\n": "P1\n");
+	fprintf(file, "#%s\n", bitmap->comment);
+	fprintf(file, "%d %d\n", bitmap->width, bitmap->height);
+	if(binary)
+	{
+		if(rowBytes>0 && bitmap->height>0 && fwrite(bitmap->bitData, rowBytes*bitmap->height, 1, file) != 1)
+			return -1;
+		return ferror(file)? -1: 0;
+	}
+	for(h=0; h<bitmap->height; h++)
+	{
+		const unsigned char *row = bitmap->bitData + h*rowBytes;
+		for(w=0; w<bitmap->width; w++)
+		{
+			fputc((row[w/8] & (0x80 >> (w%8)))? '1': '0', file);
+			if(w%70 == 69)	/*no line longer than 70 characters*/
+				fputc('\n', file);
+		}
+		if(w%70)
+			fputc('\n', file);
+	}
+	return ferror(file)? -1: 0;
+}
+
+void horizontalFlipPBM(PBM *bitmap)
+{
+	int h;
+	int rowBytes = PBM_ROW_BYTES(bitmap->width);
+	for(h=0; h<bitmap->height; h++)
+		flipRowFields(bitmap->bitData + h*rowBytes, rowBytes, bitmap->width, 1);
+}
+
+void verticalFlipPBM(PBM *bitmap)
+{
+	int h;
+	int rowBytes = PBM_ROW_BYTES(bitmap->width);
+	unsigned char row[PBM_ROW_BYTES(DEF_MAX_PIXEL_W)];
+	for(h=0; h<bitmap->height/2; h++)
+	{
+		unsigned char *top = bitmap->bitData + h*rowBytes;
+		unsigned char *bottom = bitmap->bitData + (bitmap->height-1-h)*rowBytes;
+		memcpy(row, top, rowBytes);
+		memcpy(top, bottom, rowBytes);
+		memcpy(bottom, row, rowBytes);
+	}
+}
+
+int rotate90CPBM(PBM *bitmap, Scratch *scratch)
+{
+	size_t mark = scratchMark(scratch);
+	unsigned char *src = scratchAlloc(scratch, PBM_ROW_BYTES(bitmap->width)*bitmap->height);
+	int temp;
+	if(src == NULL)
+		return -1;
+	memcpy(src, bitmap->bitData, PBM_ROW_BYTES(bitmap->width)*bitmap->height);
+	rotateFields(src, bitmap->bitData, bitmap->width, bitmap->height, 1);
+	temp = bitmap->width;
+	bitmap->width = bitmap->height;
+	bitmap->height = temp;
+	scratchRelease(scratch, mark);
+	return 0;
+}
+
+
+/*count, squared error and max error of one row, 16 pixels per step with SSE2*/
+static void compareRow(const unsigned char *a, const unsigned char *b, int width, long *count, unsigned long long *sse, int *maxError)
+{
+	int w = 0, d;
+#if defined(__SSE2__)
+	{
+		const __m128i zero = _mm_setzero_si128();
+		__m128i sum = zero, maxDiff = zero, nonZero = zero;
+		unsigned int lanes[4];
+		unsigned char maxLanes[16];
+		int i;
+		for(; w+16<=width; w+=16)
+		{
+			__m128i va = _mm_loadu_si128((const __m128i*)(a + w));
+			__m128i vb = _mm_loadu_si128((const __m128i*)(b + w));
+			__m128i diff = _mm_or_si128(_mm_subs_epu8(va, vb), _mm_subs_epu8(vb, va));
+			__m128i lo = _mm_unpacklo_epi8(diff, zero);
+			__m128i hi = _mm_unpackhi_epi8(diff, zero);
+			/*at most 19 steps of 4*255*255 per lane, no overflow in 32 bits*/
+			sum = _mm_add_epi32(sum, _mm_add_epi32(_mm_madd_epi16(lo, lo), _mm_madd_epi16(hi, hi)));
+			maxDiff = _mm_max_epu8(maxDiff, diff);
+			/*1 per different pixel, summed by sad*/
+			nonZero = _mm_add_epi64(nonZero, _mm_sad_epu8(_mm_andnot_si128(_mm_cmpeq_epi8(diff, zero), _mm_set1_epi8(1)), zero));
+		}
+		_mm_storeu_si128((__m128i*)lanes, sum);
+		*sse += (unsigned long long)lanes[0] + lanes[1] + lanes[2] + lanes[3];
+		_mm_storeu_si128((__m128i*)lanes, nonZero);
+		*count += lanes[0] + lanes[2];
+		_mm_storeu_si128((__m128i*)maxLanes, maxDiff);
+		for(i=0; i<16; i++)
+			if(maxLanes[i] > *maxError)
+				*maxError = maxLanes[i];
+	}
+#endif
+	for(; w<width; w++)
+	{
+		d = a[w]>b[w]? a[w]-b[w]: b[w]-a[w];
+		*sse += d*d;
+		*count += d>0;
+		if(d > *maxError)
+			*maxError = d;
+	}
+}
+
+int comparePGM(const PGM *a, const PGM *b, ComparePGM *result, Scratch *scratch)
+{
+	/*partial results of each band, merged at the end*/
+	struct
+	{
+		long count;
+		unsigned long long sse;
+		int maxError, minX, minY, maxX, maxY;
+		double ssim;
+	}tile[(DEF_MAX_PIXEL_H+COMPARE_TILE_ROWS-1)/COMPARE_TILE_ROWS];
+	int width = a->width, height = a->height;
+	int tiles = (height+COMPARE_TILE_ROWS-1)/COMPARE_TILE_ROWS;
+	int winW = width<SSIM_WINDOW? width: SSIM_WINDOW;
+	int winH = height<SSIM_WINDOW? height: SSIM_WINDOW;
+	int peak = a->greyMax>b->greyMax? a->greyMax: b->greyMax;
+	double c1 = (0.01*peak)*(0.01*peak), c2 = (0.03*peak)*(0.03*peak);
+	size_t mark = scratchMark(scratch);
+	IntegralPGM *tableA, *tableB;
+	unsigned long long *cross;
+	long windows;
+	int t, h, w;
+
+	memset(result, 0, sizeof(ComparePGM));
+	result->minX = result->minY = result->maxX = result->maxY = -1;
+	if(width != b->width || height != b->height)
+		return -1;
+	tableA = scratchAlloc(scratch, sizeof(IntegralPGM));
+	tableB = scratchAlloc(scratch, sizeof(IntegralPGM));
+	cross = scratchAlloc(scratch, (width+1)*(height+1)*sizeof(unsigned long long));
+	if(tableA == NULL || tableB == NULL || cross == NULL)
+	{
+		scratchRelease(scratch, mark);
+		return -1;
+	}
+	integralPGM(a, tableA);
+	integralPGM(b, tableB);
+	memset(cross, 0, (width+1)*sizeof(unsigned long long));
+	for(h=0; h<height; h++)
+	{
+		unsigned long long rowSum = 0;
+		cross[(h+1)*(width+1)] = 0;
+		for(w=0; w<width; w++)
+		{
+			rowSum += (unsigned int)a->pixelData[h*width + w] * b->pixelData[h*width + w];
+			cross[(h+1)*(width+1) + w+1] = cross[h*(width+1) + w+1] + rowSum;
+		}
+	}
+
+#ifdef _OPENMP
+#pragma omp parallel for private(h, w) schedule(static)
+#endif
+	for(t=0; t<tiles; t++)
+	{
+		int first = t*COMPARE_TILE_ROWS;
+		int last = first+COMPARE_TILE_ROWS<height? first+COMPARE_TILE_ROWS: height;
+		long before;
+		tile[t].count = 0;
+		tile[t].sse = 0;
+		tile[t].maxError = 0;
+		tile[t].minX = tile[t].minY = tile[t].maxX = tile[t].maxY = -1;
+		tile[t].ssim = 0;
+		for(h=first; h<last; h++)
+		{
+			const unsigned char *rowA = a->pixelData + h*width;
+			const unsigned char *rowB = b->pixelData + h*width;
+			before = tile[t].count;
+			compareRow(rowA, rowB, width, &tile[t].count, &tile[t].sse, &tile[t].maxError);
+			if(tile[t].count != before)
+			{
+				/*row has differences, find its ends for the bounding box*/
+				for(w=0; rowA[w]==rowB[w]; w++);
+				if(tile[t].minX<0 || w<tile[t].minX)
+					tile[t].minX = w;
+				for(w=width-1; rowA[w]==rowB[w]; w--);
+				if(w > tile[t].maxX)
+					tile[t].maxX = w;
+				if(tile[t].minY < 0)
+					tile[t].minY = h;
+				tile[t].maxY = h;
+			}
+			/*SSIM of the windows starting on this row*/
+			if(h+winH > height || winW == 0)
+				continue;
+			for(w=0; w+winW<=width; w++)
+			{
+				const unsigned long long *top = cross + h*(width+1) + w;
+				const unsigned long long *bottom = top + winH*(width+1);
+				double n = winW*winH;
+				double meanA = rectMean(tableA, w, h, winW, winH);
+				double meanB = rectMean(tableB, w, h, winW, winH);
+				double covariance = (bottom[winW] - bottom[0] - top[winW] + top[0]) / n - meanA*meanB;
+				tile[t].ssim += (2*meanA*meanB + c1) * (2*covariance + c2)
+					/ ((meanA*meanA + meanB*meanB + c1) * (rectVariance(tableA, w, h, winW, winH) + rectVariance(tableB, w, h, winW, winH) + c2));
+			}
+		}
+	}
+
+	for(t=0; t<tiles; t++)
+	{
+		result->diffCount += tile[t].count;
+		result->mse += tile[t].sse;
+		result->ssim += tile[t].ssim;
+		if(tile[t].maxError > result->maxError)
+			result->maxError = tile[t].maxError;
+		if(tile[t].minY < 0)
+			continue;
+		if(result->minY < 0)
+			result->minY = tile[t].minY;
+		result->maxY = tile[t].maxY;
+		if(result->minX<0 || tile[t].minX<result->minX)
+			result->minX = tile[t].minX;
+		if(tile[t].maxX > result->maxX)
+			result->maxX = tile[t].maxX;
+	}
+	windows = (long)(width-winW+1) * (height-winH+1);
+	result->mse = width>0 && height>0? result->mse / ((double)width*height): 0;
+	result->psnr = result->mse>0? 10*log10((double)peak*peak / result->mse): HUGE_VAL;
+	result->ssim = width>0 && height>0? result->ssim / windows: 1;
+	result->equal = result->diffCount==0 && a->greyMax==b->greyMax;
+	scratchRelease(scratch, mark);
+	return 0;
+}
+
+
+int packedBits(int greyMax)
+{
+	if(greyMax <= 1)
+		return 1;
+	if(greyMax <= 3)
+		return 2;
+	if(greyMax <= 15)
+		return 4;
+	return -1;
+}
+
+/*8 bit pixels to bits-wide fields, MSB first, padding bits 0*/
+static void packRow(const unsigned char *src, unsigned char *dst, int width, int bits)
+{
+	int w = 0;
+	memset(dst, 0, (width*bits+7)/8);
+#if defined(__SSE2__)
+	{
+		const __m128i zero = _mm_setzero_si128();
+		const __m128i low = _mm_set1_epi16(0xFF);
+		unsigned char out[16];
+		int f;
+		/*16 pixels are 2*bits whole bytes, each round merges pixel pairs into one field of twice the width*/
+		for(; w+16<=width; w+=16)
+		{
+			__m128i v = _mm_loadu_si128((const __m128i*)(src + w));
+			for(f=bits; f<8; f*=2)
+			{
+				__m128i first = _mm_sll_epi16(_mm_and_si128(v, low), _mm_cvtsi32_si128(f));
+				v = _mm_packus_epi16(_mm_or_si128(first, _mm_srli_epi16(v, 8)), zero);
+			}
+			_mm_storeu_si128((__m128i*)out, v);
+			memcpy(dst + w*bits/8, out, 2*bits);
+		}
+	}
+#endif
+	for(; w<width; w++)
+		dst[w*bits/8] |= src[w] << (8 - bits - w*bits%8);
+}
+
+static void unpackRow(const unsigned char *src, unsigned char *dst, int width, int bits)
+{
+	int w = 0;
+	int mask = (1<<bits) - 1;
+#if defined(__SSE2__)
+	{
+		const __m128i zero = _mm_setzero_si128();
+		unsigned char in[16];
+		int f;
+		/*inverse of packRow, each round splits every byte into two of half the field width*/
+		for(; w+16<=width; w+=16)
+		{
+			__m128i v;
+			memcpy(in, src + w*bits/8, 2*bits);
+			v = _mm_loadu_si128((const __m128i*)in);
+			for(f=4; f>=bits; f/=2)
+			{
+				__m128i lanes = _mm_unpacklo_epi8(v, zero);
+				__m128i second = _mm_and_si128(lanes, _mm_set1_epi16((1<<f) - 1));
+				v = _mm_or_si128(_mm_srl_epi16(lanes, _mm_cvtsi32_si128(f)), _mm_slli_epi16(second, 8));
+			}
+			_mm_storeu_si128((__m128i*)(dst + w), v);
+		}
+	}
+#endif
+	for(; w<width; w++)
+		dst[w] = (src[w*bits/8] >> (8 - bits - w*bits%8)) & mask;
+}
+
+int packPGM(const PGM *image, PackedPGM *packed)
+{
+	int h, i;
+	int bits = packedBits(image->greyMax);
+	if(bits < 0)
+		return PACKED_UNSUPPORTED;
+	/*a pixel above greyMax would saturate or spill into its neighbours*/
+	for(i=0; i<image->width*image->height; i++)
+		if(image->pixelData[i] > image->greyMax)
+			return PACKED_UNSUPPORTED;
+	strcpy(packed->comment, image->comment);
+	packed->width = image->width;
+	packed->height = image->height;
+	packed->greyMax = image->greyMax;
+	packed->bits = bits;
+	packed->rowBytes = (image->width*bits+7)/8;
+	for(h=0; h<image->height; h++)
+		packRow(image->pixelData + h*image->width, packed->packedData + h*packed->rowBytes, image->width, bits);
+	return 0;
+}
+
+void unpackPGM(const PackedPGM *packed, PGM *image)
+{
+	int h;
+	strcpy(image->comment, packed->comment);
+	image->width = packed->width;
+	image->height = packed->height;
+	image->greyMax = packed->greyMax;
+	for(h=0; h<packed->height; h++)
+		unpackRow(packed->packedData + h*packed->rowBytes, image->pixelData + h*packed->width, packed->width, packed->bits);
+}
+
+int readFilePackedPGM(FILE *file, PackedPGM *packed, Scratch *scratch)
+{
+	unsigned char row[DEF_MAX_PIXEL_W];
+	unsigned char *data;
+	size_t mark;
+	int width, height, greyMax, bits, rowBytes;
+	int h, w, temp;
+	if(readHeaderPGM(file, &width, &height, &greyMax))
+		return -1;
+	bits = packedBits(greyMax);
+	if(bits < 0)
+		return PACKED_UNSUPPORTED;
+	rowBytes = (width*bits+7)/8;
+	mark = scratchMark(scratch);
+	data = scratchAlloc(scratch, rowBytes*height);
+	if(data == NULL)
+		return -1;
+	/*one row at a time, packed as soon as it is parsed*/
+	for(h=0; h<height; h++)
+	{
+		for(w=0; w<width; w++)
+		{
+			temp = readNum(file);
+			/*readFilePGM() takes pixels above greyMax, they just do not fit the packed bits*/
+			if(temp<0 || temp>greyMax)
+			{
+				scratchRelease(scratch, mark);
+				return temp<0? -1: PACKED_UNSUPPORTED;
+			}
+			row[w] = temp;
+		}
+		packRow(row, data + h*rowBytes, width, bits);
+	}
+
+	/*store the correct image into program*/
+	packed->comment[0] = '\0';
+	packed->width = width;
+	packed->height = height;
+	packed->greyMax = greyMax;
+	packed->bits = bits;
+	packed->rowBytes = rowBytes;
+	memcpy(packed->packedData, data, rowBytes*height);
+	scratchRelease(scratch, mark);
+	return 0;
+}
+
+int writeFilePackedPGM(FILE *file, const PackedPGM *packed, int useGroupComment)
+{
+	unsigned char row[DEF_MAX_PIXEL_W];
+	int h, w;
+	/*same text as writeFilePGM*/
+    fprintf(file, "P2\n");
+	if(useGroupComment)
+	    fprintf(file, "# PGM image output by 11-02, Team 1, ICP Project, 321, 2012\n");
+	else
+		fprintf(file, "#%s\n", packed->comment);
+    fprintf(file, "%d %d\n", packed->width, packed->height);
+    fprintf(file, "%d\n", packed->greyMax);
+	for(h=0; h<packed->height; h++)
+	{
+		unpackRow(packed->packedData + h*packed->rowBytes, row, packed->width, packed->bits);
+		for(w=0; w<packed->width; w++)
+			fprintf(file, "%d ", row[w]);
+		fprintf(file, "\n");
+	}
+	return ferror(file)? -1: 0;
+}
+
+void negativePacked(PackedPGM *image)
+{
+	/*greyMax in every field, no field of the image is larger so nothing borrows across fields*/
+	unsigned char pattern = image->greyMax * (0xFF / ((1<<image->bits) - 1));
+	unsigned long long words = pattern * 0x0101010101010101ULL;
+	unsigned long long word;
+	unsigned char *data = image->packedData;
+	int size = image->rowBytes*image->height;
+	int pad = image->rowBytes*8 - image->width*image->bits;
+	int i;
+	for(i=0; i+8<=size; i+=8)
+	{
+		memcpy(&word, data + i, 8);
+		word = words - word;
+		memcpy(data + i, &word, 8);
+	}
+	for(; i<size; i++)
+		data[i] = pattern - data[i];
+	/*padding became greyMax, clear it again*/
+	if(pad)
+		for(i=image->rowBytes-1; i<size; i+=image->rowBytes)
+			data[i] &= 0xFF << pad;
+}
+
+void horizontalFlipPacked(PackedPGM *image)
+{
+	int h;
+	for(h=0; h<image->height; h++)
+		flipRowFields(image->packedData + h*image->rowBytes, image->rowBytes, image->width, image->bits);
+}
+
+void verticalFlipPacked(PackedPGM *image)
+{
+	unsigned char row[DEF_MAX_PIXEL_W];
+	int h;
+	for(h=0; h<image->height/2; h++)
+	{
+		unsigned char *top = image->packedData + h*image->rowBytes;
+		unsigned char *bottom = image->packedData + (image->height-1-h)*image->rowBytes;
+		memcpy(row, top, image->rowBytes);
+		memcpy(top, bottom, image->rowBytes);
+		memcpy(bottom, row, image->rowBytes);
+	}
+}
+
+int rotate90CPacked(PackedPGM *image, Scratch *scratch)
+{
+	size_t mark = scratchMark(scratch);
+	unsigned char *src = scratchAlloc(scratch, image->rowBytes*image->height);
+	int temp;
+	if(src == NULL)
+		return -1;
+	memcpy(src, image->packedData, image->rowBytes*image->height);
+	rotateFields(src, image->packedData, image->width, image->height, image->bits);
+	temp = image->width;
+	image->width = image->height;
+	image->height = temp;
+	image->rowBytes = (image->width*image->bits+7)/8;
+	scratchRelease(scratch, mark);
+	return 0;
+}
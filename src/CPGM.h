@@ -50,6 +50,118 @@ typedef struct
 	unsigned char pixelData[DEF_MAX_PIXEL_W*DEF_MAX_PIXEL_H];	/*!< Pixel data range from 0-255.*/
 }PGM;
 
+/**
+ * @brief Summed-area tables of a PGM
+ * @details Entry (x, y) holds the sum of all pixels above and left of pixel (x, y),
+ * row/column 0 is zero. The squared sums need 64 bits (300*300*255*255 > 2^32).
+ * About 1MB, allocate it on the heap.
+ */
+typedef struct
+{
+	int width;
+	int height;
+	unsigned int sum[(DEF_MAX_PIXEL_W+1)*(DEF_MAX_PIXEL_H+1)];	/*!< Sum of the pixels*/
+	unsigned long long sqSum[(DEF_MAX_PIXEL_W+1)*(DEF_MAX_PIXEL_H+1)];	/*!< Sum of the squared pixels*/
+}IntegralPGM;
+
+/**
+ * @def MAX_SCRATCH_HEAP
+ * Max heap blocks a Scratch may borrow before its next full release
+ */
+#define MAX_SCRATCH_HEAP 16
+
+/**
+ * @brief Reusable memory for the temporaries of effects and file reading
+ * @details A bump allocator: effects take what they need and give it back when they
+ * return, so a chain of effects reuses the same block. When the block is too small the
+ * extra comes from the heap, and the next full release grows the block to the largest
+ * size used so far, i.e. steady state does no allocation. Memory is not zeroed.
+ * Not thread safe, use one Scratch per thread.
+ */
+typedef struct
+{
+	unsigned char *data;	/*!< The block*/
+	size_t size;	/*!< Size of the block*/
+	size_t used;	/*!< Bytes of the block in use*/
+	size_t peak;	/*!< Most bytes ever in use, block and heap*/
+	void *heap[MAX_SCRATCH_HEAP];	/*!< Heap blocks borrowed since the last full release*/
+	int heapCount;
+	size_t heapUsed;
+}Scratch;
+
+/**
+ * @def PBM_ROW_BYTES
+ * Bytes used by one packed row of w pixels
+ */
+#define PBM_ROW_BYTES(w) (((w)+7)/8)
+
+/**
+ * @brief A bit-packed 1 bit per pixel image (PBM)
+ * @details Rows start on a byte boundary, most significant bit first, padding bits are 0.
+ * As in the PBM format 1 is black, which is the same layout as P4 raster data.
+ */
+typedef struct
+{
+	char comment[MAX_COMMENT_LENGTH];	/*!< Comments show in the second line of the file*/
+	int width;
+	int height;
+	unsigned char bitData[PBM_ROW_BYTES(DEF_MAX_PIXEL_W)*DEF_MAX_PIXEL_H];	/*!< Packed pixels, 1 = black*/
+}PBM;
+
+/**
+ * @def PACKED_UNSUPPORTED
+ * Returned when the image does not fit PackedPGM
+ */
+#define PACKED_UNSUPPORTED -2
+
+/**
+ * @brief A PGM stored with 1, 2 or 4 bits per pixel
+ * @details The smallest width that holds greyMax (1, 3 or 15) is used. Rows start on a
+ * byte boundary, pixels most significant bits first, padding bits are 0.
+ */
+typedef struct
+{
+	char comment[MAX_COMMENT_LENGTH];	/*!< Comments show in the second line of the file*/
+	int width;
+	int height;
+	int greyMax;
+	int bits;	/*!< Bits per pixel*/
+	int rowBytes;	/*!< Bytes per row*/
+	unsigned char packedData[(DEF_MAX_PIXEL_W*4+7)/8*DEF_MAX_PIXEL_H];	/*!< Packed pixels*/
+}PackedPGM;
+
+/**
+ * @def SSIM_WINDOW
+ * Side of the square windows of SSIM
+ */
+#define SSIM_WINDOW 7
+
+/**Differences between two images, see comparePGM()*/
+typedef struct
+{
+	int equal;	/*!< 1 if size, greyMax and every pixel are the same*/
+	long diffCount;	/*!< Number of different pixels*/
+	int minX;	/*!< Bounding box of the different pixels, -1 if none*/
+	int minY;
+	int maxX;
+	int maxY;
+	int maxError;	/*!< Largest absolute difference*/
+	double mse;	/*!< Mean squared error*/
+	double psnr;	/*!< Peak signal to noise ratio in dB, HUGE_VAL if identical*/
+	double ssim;	/*!< Mean SSIM of all SSIM_WINDOW windows, 1 if identical*/
+}ComparePGM;
+
+/**
+ * @def THRESHOLD_SAUVOLA
+ * Sauvola adaptive threshold, T = m * (1 + k * (s / R - 1)), R = greyMax / 2
+ */
+#define THRESHOLD_SAUVOLA 0
+/**
+ * @def THRESHOLD_NIBLACK
+ * Niblack adaptive threshold, T = m + k * s
+ */
+#define THRESHOLD_NIBLACK 1
+
 
 /**
  * @brief Determine the input image is null or not.
@@ -68,10 +180,12 @@ void setNullPGM(PGM *image);
 
 /**
  * @brief Read PGM file into memory
+ * @details image is only changed when the whole file is valid.
  * @param[in] file opened file pointer
  * @param[out] memory location of the image
+ * @param scratch memory for the pixels while parsing
  */
-int readFilePGM(FILE *file, PGM *image);
+int readFilePGM(FILE *file, PGM *image, Scratch *scratch);
 int writeFilePGM(FILE *file, const PGM *image, int useGroupComment);
 int embedInfoPGM(PGM *image, char* info);
 
@@ -98,14 +212,223 @@ void horizontalFlip(PGM *image);
 void verticalFlip(PGM *image);
 /**
  * @brief Rotate90C Effect
+ * @retval 0 success
+ * @retval -1 out of memory, image untouched
+ */
+int rotate90C(PGM *image, Scratch *scratch);
+/**
+ * @brief Erosion with a seWidth x seHeight rectangle
+ * @details Constant cost per pixel whatever the rectangle size. Pixels outside the
+ * image do not take part.
+ * @param[in, out] image the input image
+ * @param seWidth width of the structuring element (1 - 300)
+ * @param seHeight height of the structuring element (1 - 300)
+ * @param scratch memory for the temporaries
+ * @retval 0 success
+ * @retval -1 invalid structuring element or out of memory, image untouched
+ */
+int erode(PGM *image, int seWidth, int seHeight, Scratch *scratch);
+/**
+ * @brief Dilation with a seWidth x seHeight rectangle
+ * @see erode
+ */
+int dilate(PGM *image, int seWidth, int seHeight, Scratch *scratch);
+/**
+ * @brief Opening (erosion then dilation)
+ * @details The dilation uses the reflected rectangle, so the result never exceeds the
+ * image, even sizes included.
+ * @see erode
+ */
+int opening(PGM *image, int seWidth, int seHeight, Scratch *scratch);
+/**
+ * @brief Closing (dilation then erosion)
+ * @details The erosion uses the reflected rectangle, so the result is never below the
+ * image, even sizes included.
+ * @see erode
  */
-void rotate90C(PGM *image);
+int closing(PGM *image, int seWidth, int seHeight, Scratch *scratch);
+/**
+ * @brief White top-hat (image minus its opening)
+ * @see erode
+ */
+int topHat(PGM *image, int seWidth, int seHeight, Scratch *scratch);
+/**
+ * @brief Black top-hat (closing minus the image)
+ * @see erode
+ */
+int blackHat(PGM *image, int seWidth, int seHeight, Scratch *scratch);
 
+/**
+ * @brief Box blur, mean of the (2*radius+1) square around every pixel
+ * @details Constant cost per pixel whatever the radius. The window is clipped at the border.
+ * @retval 0 success
+ * @retval -1 invalid radius or out of memory, image untouched
+ */
+int boxBlur(PGM *image, int radius, Scratch *scratch);
+/**
+ * @brief Binarize with a local threshold from the (2*radius+1) square around every pixel
+ * @details Pixels above the threshold become greyMax, the others 0.
+ * @param method THRESHOLD_SAUVOLA (k about 0.2 - 0.5) or THRESHOLD_NIBLACK (k about -0.2)
+ * @retval 0 success
+ * @retval -1 invalid parameter or out of memory, image untouched
+ */
+int adaptiveThreshold(PGM *image, int radius, double k, int method, Scratch *scratch);
+/**
+ * @brief Median filter over the (2*radius+1) square around every pixel
+ * @details Constant cost per pixel whatever the radius (column histograms), radius 1
+ * uses a sorting network. Border pixels are replicated.
+ * @param radius 0 - 127
+ * @retval 0 success
+ * @retval -1 invalid radius or out of memory, image untouched
+ */
+int medianFilter(PGM *image, int radius, Scratch *scratch);
 
 /** @}
 ****************************************************************************************/
 
+/**
+ * @brief Global threshold by Otsu's method, from a single histogram pass
+ * @return the level t maximizing the between-class variance, pixels <= t are the dark class
+ */
+int otsuThreshold(const PGM *image);
+/**
+ * @brief Threshold an image into a packed bitmap
+ * @details Pixels <= threshold become black (1), the others white (0).
+ * @param[in] image the input image
+ * @param threshold the threshold, i.e. from otsuThreshold()
+ * @param[out] bitmap the packed result, the comment is copied
+ */
+void binarizePGM(const PGM *image, int threshold, PBM *bitmap);
+/**
+ * @brief Unpack a bitmap into a PGM with greyMax 1 (black 0, white 1)
+ */
+void unpackPBM(const PBM *bitmap, PGM *image);
+/**
+ * @brief Write a bitmap as PBM
+ * @param[in] file opened file pointer, binary mode for P4
+ * @param binary 0 => P1 (ASCII), 1 => P4 (raw)
+ * @retval 0 success
+ * @retval -1 write error
+ */
+int writeFilePBM(FILE *file, const PBM *bitmap, int binary);
+/**
+ * @brief Horizontal Flip on the packed bitmap
+ */
+void horizontalFlipPBM(PBM *bitmap);
+/**
+ * @brief Vertical Flip on the packed bitmap
+ */
+void verticalFlipPBM(PBM *bitmap);
+/**
+ * @brief Rotate90C on the packed bitmap
+ * @retval 0 success
+ * @retval -1 out of memory, bitmap untouched
+ */
+int rotate90CPBM(PBM *bitmap, Scratch *scratch);
+
+/**
+ * @brief Bits per pixel of PackedPGM for greyMax
+ * @return 1, 2 or 4, -1 if greyMax > 15
+ */
+int packedBits(int greyMax);
+/**
+ * @brief Pack an image
+ * @retval 0 success
+ * @retval PACKED_UNSUPPORTED greyMax > 15 or a pixel above greyMax, packed untouched
+ */
+int packPGM(const PGM *image, PackedPGM *packed);
+/**
+ * @brief Unpack to one byte per pixel
+ */
+void unpackPGM(const PackedPGM *packed, PGM *image);
+/**
+ * @brief Read a PGM file straight into packed form, one row at a time
+ * @details packed is only changed when the whole file is valid.
+ * @retval 0 success
+ * @retval -1 file content error or out of memory
+ * @retval PACKED_UNSUPPORTED greyMax > 15 or a pixel above greyMax, use readFilePGM()
+ */
+int readFilePackedPGM(FILE *file, PackedPGM *packed, Scratch *scratch);
+/**
+ * @brief Write a packed image, the file is the same as writeFilePGM() of the unpacked image
+ * @retval 0 success
+ * @retval -1 write error
+ */
+int writeFilePackedPGM(FILE *file, const PackedPGM *packed, int useGroupComment);
+/**
+ * @brief Negative Effect on the packed words
+ */
+void negativePacked(PackedPGM *image);
+/**
+ * @brief Horizontal Flip on the packed rows
+ */
+void horizontalFlipPacked(PackedPGM *image);
+/**
+ * @brief Vertical Flip on the packed rows
+ */
+void verticalFlipPacked(PackedPGM *image);
+/**
+ * @brief Rotate90C on the packed rows
+ * @retval 0 success
+ * @retval -1 out of memory, image untouched
+ */
+int rotate90CPacked(PackedPGM *image, Scratch *scratch);
+
+/**
+ * @brief Compare two images of the same size
+ * @details Rows are processed in bands that can run in parallel (build with -fopenmp),
+ * the peak for PSNR/SSIM is the larger greyMax.
+ * @param[out] result the differences
+ * @retval 0 success
+ * @retval -1 size differs (result->equal is 0) or out of memory
+ */
+int comparePGM(const PGM *a, const PGM *b, ComparePGM *result, Scratch *scratch);
+
+/**
+ * @brief Build the summed-area tables of an image in one pass
+ * @param[in] image the input image
+ * @param[out] table the tables
+ */
+void integralPGM(const PGM *image, IntegralPGM *table);
+/**
+ * @brief Sum of the pixels in a rectangle, in constant time
+ * @details The rectangle starts at (x, y) and is clipped to the image.
+ */
+unsigned int rectSum(const IntegralPGM *table, int x, int y, int w, int h);
+/**
+ * @brief Mean of the pixels in a rectangle, 0 if the clipped rectangle is empty
+ * @see rectSum
+ */
+double rectMean(const IntegralPGM *table, int x, int y, int w, int h);
+/**
+ * @brief Variance of the pixels in a rectangle, 0 if the clipped rectangle is empty
+ * @see rectSum
+ */
+double rectVariance(const IntegralPGM *table, int x, int y, int w, int h);
+
 void reset(PGM *image);
+
+/**
+ * @brief Start with an empty Scratch
+ */
+void initScratch(Scratch *scratch);
+/**
+ * @brief Free all memory of a Scratch, it can be used again afterwards
+ */
+void freeScratch(Scratch *scratch);
+/**
+ * @brief Take size bytes, 16-byte aligned, not zeroed
+ * @return NULL if out of memory
+ */
+void *scratchAlloc(Scratch *scratch, size_t size);
+/**
+ * @brief Current position, to give back everything taken after it with scratchRelease()
+ */
+size_t scratchMark(const Scratch *scratch);
+/**
+ * @brief Give back everything taken after mark, heap blocks go back at mark 0
+ */
+void scratchRelease(Scratch *scratch, size_t mark);
 void printPixelPGM(FILE *file,const PGM *image, char* specChar);
 void printAttPGM(FILE *file,const PGM *image);
 
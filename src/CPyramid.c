@@ -0,0 +1,254 @@
+/**
+ * @file CPyramid.c
+ * @brief Image pyramid and preview cache Implementation
+ * @author Oneonestar <oneonestar@gmail.com>
+ * @version 1.0
+ * @date 2012-10-27
+ * @copyright 2012 Oneonestar
+ *
+ * @section LICENSE
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "CPyramid.h"
+#include <stddef.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#ifdef _WIN32
+#include <direct.h>
+#endif
+
+/*!Magic and version at the start of a cache file*/
+#define CACHE_MAGIC "PYR1"
+
+/**Identity of an image file, a cache entry is only valid for the same identity*/
+typedef struct
+{
+	char fileName[FILENAME_MAX];
+	long long size;
+	long long mtime;
+	long long mtimeNsec;	/*!< Rewrites within the same second*/
+	long long inode;	/*!< Files replaced by rename*/
+	long long device;
+}FileIdentity;
+
+static const unsigned char *levelRow(const PyramidPGM *pyramid, const PGM *image, int level, int row);
+static void downsampleRow(const unsigned char *top, const unsigned char *bottom, int srcWidth, unsigned char *dst, int dstWidth);
+static void cascade(PyramidPGM *pyramid, const PGM *image, int level, int row);
+static int pyramidGeometry(PyramidPGM *pyramid, int width, int height);
+static int fileIdentity(const char *fileName, FileIdentity *identity);
+static void cachePath(const char *cacheDir, const FileIdentity *identity, char *path);
+
+static const unsigned char *levelRow(const PyramidPGM *pyramid, const PGM *image, int level, int row)
+{
+	if(level == 0)
+		return image->pixelData + row*image->width;
+	return pyramid->pixelData + pyramid->offset[level] + row*pyramid->width[level];
+}
+
+/*2x2 box mean, the last odd column/row is paired with itself*/
+static void downsampleRow(const unsigned char *top, const unsigned char *bottom, int srcWidth, unsigned char *dst, int dstWidth)
+{
+	int x, x0, x1;
+	for(x=0; x<dstWidth; x++)
+	{
+		x0 = 2*x;
+		x1 = x0+1<srcWidth? x0+1: x0;
+		dst[x] = (top[x0] + top[x1] + bottom[x0] + bottom[x1] + 2) / 4;
+	}
+}
+
+/*row of level is complete: once its pair is there, make the next level row and carry on down*/
+static void cascade(PyramidPGM *pyramid, const PGM *image, int level, int row)
+{
+	unsigned char *dst;
+	if(level+1 >= pyramid->levels)
+		return;
+	if(row%2 == 0 && row != pyramid->height[level]-1)
+		return;
+	dst = pyramid->pixelData + pyramid->offset[level+1] + row/2*pyramid->width[level+1];
+	downsampleRow(levelRow(pyramid, image, level, row - row%2), levelRow(pyramid, image, level, row),
+		pyramid->width[level], dst, pyramid->width[level+1]);
+	cascade(pyramid, image, level+1, row/2);
+}
+
+/*levels, sizes and offsets of a width x height image, returns the bytes of pixelData used*/
+static int pyramidGeometry(PyramidPGM *pyramid, int width, int height)
+{
+	int level, offset = 0;
+	pyramid->width[0] = width;
+	pyramid->height[0] = height;
+	pyramid->offset[0] = -1;
+	for(level=1; level<MAX_PYRAMID_LEVELS && (pyramid->width[level-1]>1 || pyramid->height[level-1]>1); level++)
+	{
+		pyramid->width[level] = (pyramid->width[level-1] + 1) / 2;
+		pyramid->height[level] = (pyramid->height[level-1] + 1) / 2;
+		pyramid->offset[level] = offset;
+		offset += pyramid->width[level] * pyramid->height[level];
+	}
+	pyramid->levels = level;
+	return offset;
+}
+
+void buildPyramidPGM(const PGM *image, PyramidPGM *pyramid)
+{
+	int row;
+	pyramid->greyMax = image->greyMax;
+	pyramidGeometry(pyramid, image->width, image->height);
+	for(row=0; row<image->height; row++)
+		cascade(pyramid, image, 0, row);
+}
+
+int pyramidLevelPGM(const PyramidPGM *pyramid, int level, PGM *image)
+{
+	if(level<1 || level>=pyramid->levels)
+		return -1;
+	image->comment[0] = '\0';
+	image->width = pyramid->width[level];
+	image->height = pyramid->height[level];
+	image->greyMax = pyramid->greyMax;
+	memcpy(image->pixelData, pyramid->pixelData + pyramid->offset[level], image->width*image->height);
+	return 0;
+}
+
+int pyramidLevelFor(const PyramidPGM *pyramid, int maxWidth, int maxHeight)
+{
+	int level;
+	for(level=0; level<pyramid->levels-1; level++)
+		if(pyramid->width[level]<=maxWidth && pyramid->height[level]<=maxHeight)
+			break;
+	return level;
+}
+
+static int fileIdentity(const char *fileName, FileIdentity *identity)
+{
+	struct stat info;
+	if(stat(fileName, &info) || strlen(fileName) >= FILENAME_MAX)
+		return -1;
+	memset(identity, 0, sizeof(FileIdentity));
+	strcpy(identity->fileName, fileName);
+	identity->size = info.st_size;
+	identity->mtime = info.st_mtime;
+#ifndef _WIN32
+	identity->mtimeNsec = info.st_mtim.tv_nsec;
+#endif
+	identity->inode = info.st_ino;
+	identity->device = info.st_dev;
+	return 0;
+}
+
+/*cache file name is the FNV-1a hash of the identity*/
+static void cachePath(const char *cacheDir, const FileIdentity *identity, char *path)
+{
+	unsigned long long hash = 14695981039346656037ULL;
+	const unsigned char *byte = (const unsigned char*)identity;
+	size_t i;
+	for(i=0; i<sizeof(FileIdentity); i++)
+	{
+		hash ^= byte[i];
+		hash *= 1099511628211ULL;
+	}
+	sprintf(path, "%.*s/%016llx.pyr", FILENAME_MAX-22, cacheDir, hash);
+}
+
+int loadPyramidCache(const char *cacheDir, const char *fileName, PyramidPGM *pyramid)
+{
+	char path[FILENAME_MAX];
+	char magic[sizeof(CACHE_MAGIC)];
+	FileIdentity identity, stored;
+	PyramidPGM header, geometry;
+	FILE *file;
+	int size = 0, ok;
+	if(fileIdentity(fileName, &identity))
+		return -1;
+	cachePath(cacheDir, &identity, path);
+	file = fopen(path, "rb");
+	if(file == NULL)
+		return -1;
+	ok = fread(magic, sizeof(magic), 1, file) == 1 && !memcmp(magic, CACHE_MAGIC, sizeof(magic))
+		&& fread(&stored, sizeof(stored), 1, file) == 1 && !memcmp(&stored, &identity, sizeof(identity))
+		&& fread(&header, offsetof(PyramidPGM, pixelData), 1, file) == 1
+		&& header.greyMax>0 && header.greyMax<=255
+		&& header.width[0]>0 && header.width[0]<=DEF_MAX_PIXEL_W
+		&& header.height[0]>0 && header.height[0]<=DEF_MAX_PIXEL_H;
+	/*a damaged entry must not steer pyramidLevelPGM() outside pixelData*/
+	if(ok)
+	{
+		size = pyramidGeometry(&geometry, header.width[0], header.height[0]);
+		ok = header.levels == geometry.levels
+			&& !memcmp(header.width, geometry.width, sizeof(geometry.width[0])*geometry.levels)
+			&& !memcmp(header.height, geometry.height, sizeof(geometry.height[0])*geometry.levels)
+			&& !memcmp(header.offset, geometry.offset, sizeof(geometry.offset[0])*geometry.levels)
+			&& (size==0 || fread(header.pixelData, size, 1, file) == 1);
+	}
+	fclose(file);
+	if(!ok)
+		return -1;
+	memcpy(pyramid, &header, offsetof(PyramidPGM, pixelData) + size);
+	return 0;
+}
+
+int savePyramidCache(const char *cacheDir, const char *fileName, const PyramidPGM *pyramid)
+{
+	char path[FILENAME_MAX];
+	FileIdentity identity;
+	FILE *file;
+	int size, ok;
+	if(fileIdentity(fileName, &identity))
+		return -1;
+#ifdef _WIN32
+	_mkdir(cacheDir);
+#else
+	mkdir(cacheDir, 0755);
+#endif
+	cachePath(cacheDir, &identity, path);
+	file = fopen(path, "wb");
+	if(file == NULL)
+		return -1;
+	size = pyramid->levels>1? pyramid->offset[pyramid->levels-1] + pyramid->width[pyramid->levels-1]*pyramid->height[pyramid->levels-1]: 0;
+	ok = fwrite(CACHE_MAGIC, sizeof(CACHE_MAGIC), 1, file) == 1
+		&& fwrite(&identity, sizeof(identity), 1, file) == 1
+		&& fwrite(pyramid, offsetof(PyramidPGM, pixelData), 1, file) == 1
+		&& (size==0 || fwrite(pyramid->pixelData, size, 1, file) == 1);
+	if(fclose(file) || !ok)
+	{
+		remove(path);	/*never leave a truncated entry*/
+		return -1;
+	}
+	return 0;
+}
+
+int previewPyramidPGM(const char *cacheDir, const char *fileName, PyramidPGM *pyramid, Scratch *scratch)
+{
+	size_t mark;
+	PGM *image;
+	FILE *file;
+	int status;
+	if(!loadPyramidCache(cacheDir, fileName, pyramid))
+		return 1;
+	file = fopen(fileName, "r");
+	if(file == NULL)
+		return -1;
+	mark = scratchMark(scratch);
+	image = scratchAlloc(scratch, sizeof(PGM));
+	status = image? readFilePGM(file, image, scratch): -1;
+	fclose(file);
+	if(status == 0)
+	{
+		buildPyramidPGM(image, pyramid);
+		savePyramidCache(cacheDir, fileName, pyramid);	/*a cache that cannot be written is not an error*/
+	}
+	scratchRelease(scratch, mark);
+	return status;
+}
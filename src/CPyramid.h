@@ -0,0 +1,107 @@
+/**
+ * @file CPyramid.h
+ * @brief Image pyramid and preview cache for PGM(P2) images
+ * @author Oneonestar <oneonestar@gmail.com>
+ * @version 1.0
+ * @date 2012-10-27
+ * @copyright 2012 Oneonestar
+ *
+ * @section LICENSE
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _CPYRAMID_
+#define _CPYRAMID_
+#include "CPGM.h"
+
+/**
+ * @def MAX_PYRAMID_LEVELS
+ * Levels of a 300x300 image down to 1x1, level 0 included
+ */
+#define MAX_PYRAMID_LEVELS 10
+
+/**
+ * @def PYRAMID_DATA_SIZE
+ * Upper bound of the pixels of level 1 and below (w*h/4 + w*h/16 + ... plus rounding)
+ */
+#define PYRAMID_DATA_SIZE (DEF_MAX_PIXEL_W*DEF_MAX_PIXEL_H/3 + DEF_MAX_PIXEL_W + DEF_MAX_PIXEL_H + MAX_PYRAMID_LEVELS)
+
+/**
+ * @def DEF_CACHE_DIR
+ * Default directory of the preview cache
+ */
+#define DEF_CACHE_DIR ".pgmcache"
+
+/**
+ * @brief A 2x downsampled mip pyramid of a PGM
+ * @details Level n is the image scaled by 1/2^n (rounded up), each pixel the mean of a
+ * 2x2 block of level n-1. Level 0 is the full image and is not stored.
+ */
+typedef struct
+{
+	int levels;	/*!< Number of levels, level 0 included*/
+	int greyMax;
+	int width[MAX_PYRAMID_LEVELS];
+	int height[MAX_PYRAMID_LEVELS];
+	int offset[MAX_PYRAMID_LEVELS];	/*!< Start of each level in pixelData, -1 for level 0*/
+	unsigned char pixelData[PYRAMID_DATA_SIZE];
+}PyramidPGM;
+
+/**
+ * @brief Build every level of the pyramid in one pass over the image
+ * @details Each finished row is pushed down the levels at once, so the image is read once
+ * and every level row is still in cache when the next level needs it.
+ */
+void buildPyramidPGM(const PGM *image, PyramidPGM *pyramid);
+
+/**
+ * @brief Copy one stored level into a PGM
+ * @retval 0 success
+ * @retval -1 level 0 or out of range
+ */
+int pyramidLevelPGM(const PyramidPGM *pyramid, int level, PGM *image);
+
+/**
+ * @brief The largest level not wider than maxWidth and not higher than maxHeight
+ * @return the level, 0 if the full image fits, levels-1 if none fits
+ */
+int pyramidLevelFor(const PyramidPGM *pyramid, int maxWidth, int maxHeight);
+
+/**
+ * @brief Load the cached pyramid of a file
+ * @details The cache entry is keyed by file name, size, modification time (with
+ * nanoseconds), inode and device, so a changed or replaced file misses.
+ * @retval 0 hit
+ * @retval -1 miss
+ */
+int loadPyramidCache(const char *cacheDir, const char *fileName, PyramidPGM *pyramid);
+
+/**
+ * @brief Store the pyramid of a file in the cache, creating cacheDir if needed
+ * @retval 0 success
+ * @retval -1 cannot write
+ */
+int savePyramidCache(const char *cacheDir, const char *fileName, const PyramidPGM *pyramid);
+
+/**
+ * @brief Get the pyramid of a file, from the cache or by reading the file once
+ * @details On a miss the file is read, the pyramid built and written to the cache.
+ * @retval 1 cache hit, the file was not read
+ * @retval 0 built from the file
+ * @retval -1 cannot read the file
+ */
+int previewPyramidPGM(const char *cacheDir, const char *fileName, PyramidPGM *pyramid, Scratch *scratch);
+
+#endif
@@ -23,9 +23,14 @@
  */
 
 #include "CPGM.h"
+#include "CPyramid.h"
+#include "CChain.h"
+#include "CCache.h"
+#include "CAsyncIO.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 
 
 /**
@@ -53,8 +58,9 @@ void cProcess(PGM *image);
  * @brief Option 'e' - Effects apply to PGM file
  * @details Sub-menu for applying Effect to image.
  * @param[in, out] image The memory area to hold the image data.
+ * @param scratch Memory reused by the effects.
  */
-void eProcess(PGM *image);
+void eProcess(PGM *image, Scratch *scratch);
 
 /**
  * @brief Option 'm' - ID Marking
@@ -67,8 +73,9 @@ void mProcess(PGM *image);
  * @brief Option 'r' - Read PGM file
  * @details Load PGM file into memory.
  * @param[out] image The memory area to hold the image data.
+ * @param scratch Memory reused while reading.
  */
-void rProcess(PGM *image);
+void rProcess(PGM *image, Scratch *scratch);
 
 /**
  * @brief Option 'v' - Character-View
@@ -84,6 +91,22 @@ void vProcess(const PGM *image);
  */
 void wProcess(const PGM *image);
 
+/**
+ * @brief Option 'b' - Binarize to PBM file
+ * @details Threshold the stored image (Otsu or manual) and write it as a P1/P4 bitmap.
+ * The stored image is not changed.
+ * @param[in] image The memory area to hold the image data.
+ */
+void bProcess(const PGM *image);
+
+/**
+ * @brief Option 'p' - Preview a PGM file
+ * @details Character-View a file scaled down to fit, from the cached image pyramid.
+ * The stored image is not changed.
+ * @param scratch Memory reused while reading.
+ */
+void pProcess(Scratch *scratch);
+
 /**
  * @brief Print the main menu and the option list
  */
@@ -132,17 +155,98 @@ int CLIReadNum(char* string);
 
 int checkOverwrite(char* fileName);
 
-int main()
+/**One conversion of batch mode, shared by every file*/
+typedef struct
+{
+	EffectChain chain;
+	int packable;	/*!< The chain works on packed images*/
+	int packed;	/*!< The last image was kept packed*/
+	PGM image;
+	PackedPGM packedImage;
+	Scratch scratch;
+}BatchJob;
+
+/**
+ * @brief Batch mode, apply an effect chain to many files without the menu
+ * @details icp1102_01 -e chain [-c cacheDir] [-s cacheMB] [-a uring|pread] in.pgm out.pgm [in.pgm out.pgm ...]\n
+ * With -c, outputs are cached by the hash of the input file and the chain, a hit
+ * copies the cached output without reading the image.\n
+ * With -a, files are read and written through CAsyncIO instead of stdio.
+ * @return 0 if every file was converted
+ */
+int batchMain(int argc, char *argv[]);
+
+/**
+ * @brief Batch mode with -a
+ * @param[in, out] backend the backend asked for, the one used on return
+ * @param files count in.pgm out.pgm pairs
+ * @return number of failed files, -1 if the backend cannot be set up
+ */
+int asyncBatch(int *backend, int count, char *files[], BatchJob *job);
+
+/**
+ * @brief Read one image of a batch and apply the chain
+ * @retval -1 File Content Error
+ * @retval -2 Effect failed
+ */
+int convertBatchFile(FILE *file, BatchJob *job);
+
+/**
+ * @brief Write the image converted by convertBatchFile()
+ * @retval -1 write error
+ */
+int writeBatchFile(FILE *file, const BatchJob *job);
+
+/**
+ * @brief AsyncConvert of batch mode, runs convertBatchFile() on memory streams
+ */
+long convertBatchBuffer(const unsigned char *input, size_t size, unsigned char *output, size_t capacity, void *context);
+
+/**
+ * @brief Wall clock in seconds, for the files/s of batch mode
+ */
+double wallClock(void);
+
+/**
+ * @brief Compare mode, icp1102_01 -d a.pgm b.pgm
+ * @return 0 equal, 1 different, 2 cannot compare
+ */
+int compareMain(int argc, char *argv[]);
+
+/**
+ * @brief Print the result of comparePGM()
+ */
+void printCompare(const ComparePGM *result);
+
+/**
+ * @brief Option 'd' - Compare the stored image with a file
+ * @param[in] image The memory area to hold the image data.
+ * @param scratch Memory reused while reading and comparing.
+ */
+void dProcess(const PGM *image, Scratch *scratch);
+
+/**
+ * @brief Print the command line usage
+ */
+void printUsage(const char *program);
+
+int main(int argc, char *argv[])
 {
     char control[MAX_STRING_BUFFER];
     PGM image;
+	Scratch scratch;
+	if(argc > 1 && !strcmp(argv[1], "-d"))
+		return compareMain(argc, argv);
+	if(argc > 1)
+		return batchMain(argc, argv);
 	setNullPGM(&image);
+	initScratch(&scratch);
     do
     {
         printMainMenu();
 		safeGetString(control, MAX_STRING_BUFFER);
         if(!strcmp(control, "r"))
-			rProcess(&image);
+			rProcess(&image, &scratch);
 		else if(!strcmp(control, "c"))
             cProcess(&image);
 		else if(!strcmp(control, "w"))
@@ -152,17 +256,24 @@ int main()
 		else if(!strcmp(control, "m"))
 			mProcess(&image);
 		else if(!strcmp(control, "e"))
-			eProcess(&image);
+			eProcess(&image, &scratch);
+		else if(!strcmp(control, "b"))
+			bProcess(&image);
+		else if(!strcmp(control, "p"))
+			pProcess(&scratch);
+		else if(!strcmp(control, "d"))
+			dProcess(&image, &scratch);
 		else if(!strcmp(control, "q"))
             break;
 		else
             printf("\n\n>>> UNKNOWN '%s' option selected. Plerase enter your choice again:\n", control);
     } while(1);
+	freeScratch(&scratch);
 	printf("\n>>> Option 'q'!\nBye.");
     return 0;
 }
 
-void rProcess(PGM *image)
+void rProcess(PGM *image, Scratch *scratch)
 {
     char fileName[FILENAME_MAX];
 	FILE *file;
@@ -177,7 +288,7 @@ void rProcess(PGM *image)
         return;
     }
 
-    if(readFilePGM(file, image)<0)
+    if(readFilePGM(file, image, scratch)<0)
 	{
 		printf("File Content Error!");
 		fclose(file);
@@ -327,9 +438,9 @@ void mProcess(PGM *image)
 	printf("\n>>>Option 'm' Finished!\n");
 }
 
-void eProcess(PGM *image)
+void eProcess(PGM *image, Scratch *scratch)
 {
-	int i;
+	int i, seWidth, seHeight, radius;
 	printf("Option 'e' selected: Image Effect...\n");
 	if(isNullPGM(image))
 	{
@@ -342,8 +453,27 @@ void eProcess(PGM *image)
 '3': Vertical Flip\n\
 '4': Rotate 90 Clockwise\n\
 '5': Rotate 90 Anti-Clockwise\n\
-'6': Rotate 180 Clockwise\n\n");
-	i = safeGetInt("Please select effect: ", 1, 6);
+'6': Rotate 180 Clockwise\n\
+'7': Erode\n\
+'8': Dilate\n\
+'9': Opening\n\
+'10': Closing\n\
+'11': Top-Hat\n\
+'12': Black Top-Hat\n\
+'13': Box Blur\n\
+'14': Sauvola Threshold\n\
+'15': Niblack Threshold\n\
+'16': Median Filter\n\n");
+	i = safeGetInt("Please select effect: ", 1, 16);
+	if(i==16)
+		radius = safeGetInt("Please input the radius (0 - 127): ", 0, 127);
+	else if(i>=13)
+		radius = safeGetInt("Please input the radius (0 - 300): ", 0, 300);
+	else if(i>=7)
+	{
+		seWidth = safeGetInt("Please input the structuring element width (1 - 300): ", 1, 300);
+		seHeight = safeGetInt("Please input the structuring element height (1 - 300): ", 1, 300);
+	}
 	switch(i)
 	{
 		case 1:
@@ -356,21 +486,481 @@ void eProcess(PGM *image)
 			verticalFlip(image);
 			break;
 		case 4:
-			rotate90C(image);
+			rotate90C(image, scratch);
 			break;
 		case 5:
-			rotate90C(image);
-			rotate90C(image);
-			rotate90C(image);
+			rotate90C(image, scratch);
+			rotate90C(image, scratch);
+			rotate90C(image, scratch);
 			break;
 		case 6:
-			rotate90C(image);
-			rotate90C(image);
+			/*same as two rotations, done in place*/
+			horizontalFlip(image);
+			verticalFlip(image);
+			break;
+		case 7:
+			erode(image, seWidth, seHeight, scratch);
+			break;
+		case 8:
+			dilate(image, seWidth, seHeight, scratch);
+			break;
+		case 9:
+			opening(image, seWidth, seHeight, scratch);
+			break;
+		case 10:
+			closing(image, seWidth, seHeight, scratch);
+			break;
+		case 11:
+			topHat(image, seWidth, seHeight, scratch);
+			break;
+		case 12:
+			blackHat(image, seWidth, seHeight, scratch);
+			break;
+		case 13:
+			boxBlur(image, radius, scratch);
+			break;
+		case 14:
+			adaptiveThreshold(image, radius, 0.34, THRESHOLD_SAUVOLA, scratch);
+			break;
+		case 15:
+			adaptiveThreshold(image, radius, -0.2, THRESHOLD_NIBLACK, scratch);
+			break;
+		case 16:
+			medianFilter(image, radius, scratch);
 			break;
 	}
     printf("\n\n>>> Option 'e' Finished!");
 }
 
+void bProcess(const PGM *image)
+{
+	char fileName[FILENAME_MAX];
+	char prompt[MAX_STRING_BUFFER];
+	PBM bitmap;
+	FILE *file;
+	int threshold, binary, status;
+	printf("Option 'b' selected: Binarize the stored image to a PBM file...\n");
+	if(isNullPGM(image))
+	{
+		printf("\n>> No Input Image Stored... Option 'b' Aborted!");
+		return;
+	}
+	if(safeGetInt("Threshold:\n1. Automatic (Otsu)\n2. Manual\nSelect: ", 1, 2) == 1)
+	{
+		threshold = otsuThreshold(image);
+		printf("Otsu threshold = %d\n", threshold);
+	}
+	else
+	{
+		sprintf(prompt, "Please input the threshold, pixels <= threshold become black (0 - %d): ", image->greyMax);
+		threshold = safeGetInt(prompt, 0, image->greyMax);
+	}
+	binary = safeGetInt("Format:\n1. P1 (ASCII)\n2. P4 (Raw)\nSelect: ", 1, 2) == 2;
+	printf("Please enter the NEW <PBM> image file name: ");
+	getFileName(fileName);
+	/*if user don't want to overwrite => exit*/
+	if(checkOverwrite(fileName))
+		return;
+
+	file = fopen(fileName, binary? "wb": "w");
+	if(file==NULL)
+	{
+		printf("CANNOT open file: %s.  Do nothing!\n\n", fileName);
+		printf(">> Cannot write image... Option 'b' Aborted!");
+		return;
+	}
+	binarizePGM(image, threshold, &bitmap);
+	status = writeFilePBM(file, &bitmap, binary);
+	if(fclose(file) || status)
+	{
+		printf("CANNOT write file: %s.\n\n", fileName);
+		printf(">> Cannot write image... Option 'b' Aborted!");
+		return;
+	}
+	printf("\n>>>Option 'b' Finished!\n");
+}
+
+void pProcess(Scratch *scratch)
+{
+	char fileName[FILENAME_MAX];
+	char sequence[MAX_STRING_BUFFER];
+	PyramidPGM pyramid;
+	PGM view;
+	FILE *file;
+	int maxWidth, maxHeight, level, status;
+	printf("Option 'p' selected: Preview a PGM file with specified characters...\n");
+	printf("Please enter the <P2> PGM image file name: ");
+	getFileName(fileName);
+	status = previewPyramidPGM(DEF_CACHE_DIR, fileName, &pyramid, scratch);
+	if(status < 0)
+	{
+		printf("CANNOT read file: %s.  Do nothing!\n\n", fileName);
+		printf(">> Cannot read image... Option 'p' Aborted!");
+		return;
+	}
+	maxWidth = safeGetInt("Please input the max preview width (1 - 300): ", 1, 300);
+	maxHeight = safeGetInt("Please input the max preview height (1 - 300): ", 1, 300);
+	do
+	{
+		printf("Please enter a sequence of characters, representing ZERO to MAX grey -levels:\n");
+		safeGetString(sequence, MAX_STRING_BUFFER);
+	}while(strlen(sequence)==0);
+
+	level = pyramidLevelFor(&pyramid, maxWidth, maxHeight);
+	if(level > 0)
+		pyramidLevelPGM(&pyramid, level, &view);
+	else
+	{
+		/*full size fits, the only case that reads the full image*/
+		file = fopen(fileName, "r");
+		if(file == NULL || readFilePGM(file, &view, scratch)<0)
+		{
+			if(file)
+				fclose(file);
+			printf(">> Cannot read image... Option 'p' Aborted!");
+			return;
+		}
+		fclose(file);
+	}
+	printf("Level %d (1/%d), w[%d], h[%d]%s\n", level, 1<<level, view.width, view.height, level>0 && status==1? ", from cache": "");
+	printPixelPGM(stdout, &view, sequence);
+	printf("\n>>>Option 'p' Finished!\n");
+}
+
+void printUsage(const char *program)
+{
+	printf("Usage: %s -e <chain> [-c <cache dir>] [-s <cache MB>] [-a uring|pread] <in.pgm> <out.pgm> [<in.pgm> <out.pgm> ...]\n\
+       %s -d <a.pgm> <b.pgm>\n\
+Without arguments the interactive menu starts.\n\
+  -e  effects separated by ',', e.g. negative,rotate90c,median:2,mark:32110552020\n\
+      negative hflip vflip rotate90c rotate90cc rotate180\n\
+      erode:w:h dilate:w:h open:w:h close:w:h tophat:w:h blackhat:w:h\n\
+      blur:r sauvola:r niblack:r median:r mark:digits\n\
+  -c  cache the outputs in this directory (%s if the value is '-')\n\
+  -s  max cache size in MB (default 64)\n\
+  -a  read and write with io_uring or pread/pwrite instead of stdio\n\
+  -d  compare two images, exit code 0 equal, 1 different, 2 error\n", program, program, DEF_RESULT_CACHE_DIR);
+}
+
+int batchMain(int argc, char *argv[])
+{
+	char chainText[MAX_CHAIN_TEXT];
+	const char *chainArg = NULL, *cacheDir = NULL;
+	unsigned long cacheMB = 64;
+	unsigned long long chainHash, key;
+	static ResultCache cache;
+	static BatchJob job;
+	FILE *file;
+	double elapsed;
+	int i, first, status, haveKey, backend = 0, failed = 0;
+
+	for(i=1; i<argc && argv[i][0]=='-'; i+=2)
+	{
+		if(i+1 >= argc)
+			break;
+		if(!strcmp(argv[i], "-e"))
+			chainArg = argv[i+1];
+		else if(!strcmp(argv[i], "-c"))
+			cacheDir = strcmp(argv[i+1], "-")? argv[i+1]: DEF_RESULT_CACHE_DIR;
+		else if(!strcmp(argv[i], "-s") && CLIReadNum(argv[i+1]) > 0)
+			cacheMB = CLIReadNum(argv[i+1]);
+		else if(!strcmp(argv[i], "-a") && !strcmp(argv[i+1], "uring"))
+			backend = ASYNC_URING;
+		else if(!strcmp(argv[i], "-a") && !strcmp(argv[i+1], "pread"))
+			backend = ASYNC_PREAD;
+		else
+		{
+			printUsage(argv[0]);
+			return 2;
+		}
+	}
+	if(chainArg == NULL || i >= argc || (argc-i)%2)
+	{
+		printUsage(argv[0]);
+		return 2;
+	}
+	if(parseEffectChain(chainArg, &job.chain))
+	{
+		fprintf(stderr, "Invalid effect chain: %s\n", chainArg);
+		return 2;
+	}
+	/*the cache hashes and copies through stdio*/
+	if(backend && cacheDir)
+	{
+		fprintf(stderr, "-c is not used with -a, continue without cache\n");
+		cacheDir = NULL;
+	}
+	/*canonical text, so equal chains share cache entries, and only outputs of this version*/
+	encodeEffectChain(&job.chain, chainText);
+	chainHash = hashBytes(chainText, strlen(chainText), RESULT_VERSION);
+	job.packable = isPackedEffectChain(&job.chain);
+	if(cacheDir && openResultCache(&cache, cacheDir, cacheMB*1024*1024))
+	{
+		fprintf(stderr, "CANNOT open cache %s, continue without it\n", cacheDir);
+		cacheDir = NULL;
+	}
+
+	initScratch(&job.scratch);
+	first = i;
+	elapsed = wallClock();
+	if(backend)
+	{
+		failed = asyncBatch(&backend, (argc-first)/2, argv+first, &job);
+		if(failed < 0)
+		{
+			fprintf(stderr, "CANNOT set up the file I/O backend\n");
+			freeScratch(&job.scratch);
+			return 2;
+		}
+	}
+	for(; !backend && i+1<argc; i+=2)
+	{
+		file = fopen(argv[i], "rb");
+		if(file == NULL)
+		{
+			fprintf(stderr, "CANNOT open file: %s\n", argv[i]);
+			failed++;
+			continue;
+		}
+		haveKey = 0;
+		if(cacheDir)
+		{
+			haveKey = !hashFile(file, chainHash, &key);
+			if(haveKey && !lookupResultCache(&cache, key, argv[i+1]))
+			{
+				fclose(file);
+				printf("%s -> %s (cached)\n", argv[i], argv[i+1]);
+				continue;
+			}
+			rewind(file);
+		}
+		status = convertBatchFile(file, &job);
+		fclose(file);
+		if(status < 0)
+		{
+			fprintf(stderr, "%s: %s\n", argv[i], status==-1? "File Content Error!": "Effect failed!");
+			failed++;
+			continue;
+		}
+		file = fopen(argv[i+1], "w");
+		if(file == NULL)
+		{
+			fprintf(stderr, "CANNOT open file: %s\n", argv[i+1]);
+			failed++;
+			continue;
+		}
+		/*a truncated output must not reach the cache*/
+		status = writeBatchFile(file, &job);
+		if(fclose(file) || status)
+		{
+			fprintf(stderr, "CANNOT write file: %s\n", argv[i+1]);
+			failed++;
+			continue;
+		}
+		if(haveKey)
+			storeResultCache(&cache, key, argv[i+1]);
+		printf("%s -> %s\n", argv[i], argv[i+1]);
+	}
+	elapsed = wallClock()-elapsed;
+	printf("%d files in %.3f s, %.1f files/s (%s)\n", (argc-first)/2, elapsed,
+		elapsed>0? (argc-first)/2/elapsed: 0.0, backend==ASYNC_URING? "io_uring": backend? "pread": "stdio");
+	if(cacheDir)
+	{
+		printf("Cache: %lu hits, %lu misses, %lu evictions, %lu bytes\n", cache.hits, cache.misses, cache.evictions, cache.bytes);
+		closeResultCache(&cache);
+	}
+	freeScratch(&job.scratch);
+	return failed? 1: 0;
+}
+
+int asyncBatch(int *backend, int count, char *files[], BatchJob *job)
+{
+	static AsyncIO io;
+	char **inputs, **outputs;
+	int i, *status, failed;
+
+	inputs = malloc(count*sizeof(char*));
+	outputs = malloc(count*sizeof(char*));
+	status = malloc(count*sizeof(int));
+	if(inputs == NULL || outputs == NULL || status == NULL || openAsyncIO(&io, *backend) < 0)
+	{
+		free(inputs);
+		free(outputs);
+		free(status);
+		return -1;
+	}
+	if(io.backend != *backend)
+		fprintf(stderr, "io_uring is not available, use pread\n");
+	*backend = io.backend;
+	for(i=0; i<count; i++)
+	{
+		inputs[i] = files[2*i];
+		outputs[i] = files[2*i+1];
+	}
+	failed = asyncConvertFiles(&io, count, inputs, outputs, convertBatchBuffer, job, status);
+	for(i=0; i<count; i++)
+	{
+		if(status[i])
+			fprintf(stderr, "CANNOT convert file: %s\n", inputs[i]);
+		else
+			printf("%s -> %s\n", inputs[i], outputs[i]);
+	}
+	closeAsyncIO(&io);
+	free(inputs);
+	free(outputs);
+	free(status);
+	return failed;
+}
+
+int convertBatchFile(FILE *file, BatchJob *job)
+{
+	int status = 0;
+	/*images with greyMax <= 15 stay packed when the chain allows it*/
+	job->packed = 0;
+	if(job->packable)
+	{
+		status = readFilePackedPGM(file, &job->packedImage, &job->scratch);
+		if(status == PACKED_UNSUPPORTED)
+			rewind(file);
+		else
+			job->packed = 1;
+	}
+	if(!job->packed)
+		status = readFilePGM(file, &job->image, &job->scratch);
+	if(status < 0)
+		return -1;
+	if(job->packed? applyEffectChainPacked(&job->packedImage, &job->chain, &job->scratch):
+		applyEffectChain(&job->image, &job->chain, &job->scratch))
+		return -2;
+	return 0;
+}
+
+int writeBatchFile(FILE *file, const BatchJob *job)
+{
+	if(job->packed)
+		return writeFilePackedPGM(file, &job->packedImage, 1);
+	return writeFilePGM(file, &job->image, 1);
+}
+
+long convertBatchBuffer(const unsigned char *input, size_t size, unsigned char *output, size_t capacity, void *context)
+{
+#ifdef _WIN32
+	return -1;
+#else
+	FILE *file;
+	long length;
+	int status;
+	if(size == 0 || (file = fmemopen((void*)input, size, "r")) == NULL)
+		return -1;
+	length = convertBatchFile(file, context);
+	fclose(file);
+	if(length < 0 || (file = fmemopen(output, capacity, "w")) == NULL)
+		return -1;
+	status = writeBatchFile(file, context);
+	length = ftell(file);
+	/*a full buffer means the output was cut*/
+	if(fclose(file) || status || length < 0 || (size_t)length >= capacity)
+		return -1;
+	return length;
+#endif
+}
+
+double wallClock(void)
+{
+#ifdef _WIN32
+	return (double)clock()/CLOCKS_PER_SEC;
+#else
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return now.tv_sec+now.tv_nsec/1e9;
+#endif
+}
+
+void printCompare(const ComparePGM *result)
+{
+	printf("Equal: %s\n", result->equal? "yes": "no");
+	printf("Different pixels: %ld\n", result->diffCount);
+	if(result->diffCount)
+		printf("Bounding box: x[%d - %d], y[%d - %d]\n", result->minX, result->maxX, result->minY, result->maxY);
+	printf("Max abs error: %d\n", result->maxError);
+	printf("MSE: %.4f\n", result->mse);
+	printf("PSNR: %.2f dB\n", result->psnr);
+	printf("SSIM: %.4f\n", result->ssim);
+}
+
+int compareMain(int argc, char *argv[])
+{
+	static PGM image[2];
+	ComparePGM result;
+	Scratch scratch;
+	FILE *file;
+	int i, status = 0;
+	if(argc != 4)
+	{
+		printUsage(argv[0]);
+		return 2;
+	}
+	initScratch(&scratch);
+	for(i=0; i<2 && !status; i++)
+	{
+		file = fopen(argv[2+i], "r");
+		if(file == NULL || readFilePGM(file, &image[i], &scratch)<0)
+		{
+			fprintf(stderr, "CANNOT read file: %s\n", argv[2+i]);
+			status = 2;
+		}
+		if(file)
+			fclose(file);
+	}
+	if(!status && comparePGM(&image[0], &image[1], &result, &scratch))
+	{
+		printf("Size differs: w[%d], h[%d] vs w[%d], h[%d]\n", image[0].width, image[0].height, image[1].width, image[1].height);
+		status = 1;
+	}
+	else if(!status)
+	{
+		printCompare(&result);
+		status = !result.equal;
+	}
+	freeScratch(&scratch);
+	return status;
+}
+
+void dProcess(const PGM *image, Scratch *scratch)
+{
+	char fileName[FILENAME_MAX];
+	ComparePGM result;
+	PGM other;
+	FILE *file;
+	printf("Option 'd' selected: Compare the stored image with a file...\n");
+	if(isNullPGM(image))
+	{
+		printf("\n>> No Input Image Stored... Option 'd' Aborted!");
+		return;
+	}
+	printf("Please enter the <P2> PGM image file name: ");
+	getFileName(fileName);
+	file = fopen(fileName, "r");
+	if(file == NULL)
+	{
+		printf("CANNOT open file: %s.  Do nothing!\n\n", fileName);
+		printf(">> Cannot read image... Option 'd' Aborted!");
+		return;
+	}
+	if(readFilePGM(file, &other, scratch)<0)
+	{
+		printf("File Content Error!");
+		fclose(file);
+		return;
+	}
+	fclose(file);
+	if(comparePGM(image, &other, &result, scratch))
+		printf("Size differs: w[%d], h[%d] vs w[%d], h[%d]\n", image->width, image->height, other.width, other.height);
+	else
+		printCompare(&result);
+	printf("\n>>>Option 'd' Finished!\n");
+}
+
 void printMainMenu()
 { 
     printf("\n\n\
@@ -387,6 +977,9 @@ Available options below:\n\
 	printf("\
 'm': IDMARK IMAGE:           Create ID Marking to Image\n\
 'e': IMAGE EFFECT ADDED:     Create and ADD Effect to Image\n\
+'b': BINARIZE TO PBM:        Threshold the Image, Write P1/P4 Bitmap\n\
+'p': PREVIEW FILE:           Character-View a File Scaled Down to Fit\n\
+'d': COMPARE WITH FILE:      Compare the Stored Image with a File\n\
 'q': QUIT:                   Quit Porgram\n\
 =========================================================================\n\n\
 Please enter your option character, followed by an <Enter> key:");